@@ -0,0 +1,217 @@
+#include "autosave.h"
+#include <algorithm>
+#include <cstring>
+
+static const quint32 MAGIC = 0x514d5041;  // "QMPA"
+static const quint16 VERSION = 2;
+
+Autosave::Autosave(QString _file_name, QLockFile* _lock, QObject* parent)
+    : QThread(parent), lock(_lock), file_name(_file_name) {}
+
+Autosave::~Autosave() {
+  {
+    QMutexLocker locker(&queue_mutex);
+    quitting = true;
+  }
+  queue_changed.wakeAll();
+  wait();
+}
+
+void Autosave::resize(QSize size) {
+  enqueue({size_record, QRect(QPoint(0, 0), size), QImage()});
+}
+
+void Autosave::append(QRect rect, QImage pixels) {
+  enqueue({tile_record, rect, pixels});
+}
+
+void Autosave::checkpoint() { enqueue({checkpoint_record, QRect(), QImage()}); }
+
+void Autosave::enqueue(const Queued& queued) {
+  QMutexLocker locker(&queue_mutex);
+  queue.enqueue(queued);
+  queue_changed.wakeAll();
+}
+
+QString Autosave::defaultFileName() {
+  const QString directory =
+      QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+  QDir().mkpath(directory);
+
+  return directory + "/autosave.journal";
+}
+
+void Autosave::run() {
+  // records are dropped if the file cannot be written, so they do not pile up
+  const bool opened = open(true);
+  if (!opened) qWarning() << "Autosave cannot be written:" << file_name;
+
+  forever {
+    Queued queued;
+    {
+      QMutexLocker locker(&queue_mutex);
+      while (queue.isEmpty() && !quitting) queue_changed.wait(&queue_mutex);
+      if (quitting) break;
+      queued = queue.dequeue();
+    }
+
+    if (opened) write(queued);
+  }
+
+  file.close();
+  file.remove();
+}
+
+bool Autosave::open(bool truncate) {
+  file.setFileName(file_name);
+  if (!file.open(truncate ? QIODevice::WriteOnly : QIODevice::Append))
+    return false;
+
+  stream.setDevice(&file);
+  if (truncate) writeHeader(stream);
+
+  return true;
+}
+
+void Autosave::write(const Queued& queued) {
+  switch (queued.type) {
+    case size_record:
+      size = queued.rect.size();
+      stream << quint8(size_record) << qint32(size.width())
+             << qint32(size.height());
+      break;
+
+    case tile_record:
+      if (writeTile(stream, queued.rect, queued.pixels))
+        written += qint64(queued.rect.width()) * queued.rect.height();
+      break;
+
+    case color_record:
+      break;  // only written by writeTile
+
+    case checkpoint_record:
+      stream << quint8(checkpoint_record);
+      file.flush();
+      // tiles rewritten over and over make the file a few pictures long
+      if (written > 4 * qint64(size.width()) * size.height()) compact();
+      break;
+  }
+}
+
+// only right after a checkpoint, so nothing written is left out
+void Autosave::compact() {
+  file.close();
+  const TiledImage picture = recover(file_name);
+
+  QSaveFile output(file_name);
+  if (!picture.isNull() && output.open(QIODevice::WriteOnly)) {
+    QDataStream out(&output);
+    writeHeader(out);
+    out << quint8(size_record) << qint32(picture.width())
+        << qint32(picture.height());
+    for (int y = 0; y < picture.height(); y += TILE_SIZE)
+      for (int x = 0; x < picture.width(); x += TILE_SIZE) {
+        const QRect rect = QRect(x, y, TILE_SIZE, TILE_SIZE) & picture.rect();
+        writeTile(out, rect, picture.render(rect, 1));
+      }
+    out << quint8(checkpoint_record);
+    output.commit();
+  }
+
+  open(false);
+  written = 0;
+}
+
+void Autosave::writeHeader(QDataStream& out) { out << MAGIC << VERSION; }
+
+// rows of pixels without padding, compressed quickly; tiles of a single
+// colour take a colour record instead. Returns false for those
+bool Autosave::writeTile(QDataStream& out, QRect rect, const QImage& pixels) {
+  const QRgb first = pixels.pixel(0, 0);
+  bool uniform = true;
+  for (int y = 0; y < rect.height() && uniform; ++y) {
+    const QRgb* line = (const QRgb*)pixels.constScanLine(y);
+    uniform = std::all_of(line, line + rect.width(),
+                          [first](QRgb pixel) { return pixel == first; });
+  }
+  if (uniform) {
+    out << quint8(color_record) << qint32(rect.x()) << qint32(rect.y())
+        << qint32(rect.width()) << qint32(rect.height()) << quint32(first);
+    return false;
+  }
+
+  const int row_bytes = rect.width() * sizeof(QRgb);
+  QByteArray rows(row_bytes * rect.height(), 0);
+  for (int y = 0; y < rect.height(); ++y)
+    memcpy(rows.data() + y * row_bytes, pixels.constScanLine(y), row_bytes);
+
+  out << quint8(tile_record) << qint32(rect.x()) << qint32(rect.y())
+      << qint32(rect.width()) << qint32(rect.height()) << qCompress(rows, 1);
+  return true;
+}
+
+// records after the last checkpoint, possibly torn by a crash, are ignored
+TiledImage Autosave::recover(QString file_name) {
+  QFile input(file_name);
+  if (!input.open(QIODevice::ReadOnly)) return TiledImage();
+
+  QDataStream in(&input);
+  quint32 magic;
+  quint16 version;
+  in >> magic >> version;
+  if (magic != MAGIC || version != VERSION) return TiledImage();
+
+  TiledImage picture;
+  QVector<Queued> pending;
+  while (!in.atEnd()) {
+    quint8 type;
+    in >> type;
+
+    if (type == size_record) {
+      qint32 width, height;
+      in >> width >> height;
+      if (in.status() != QDataStream::Ok || width <= 0 || height <= 0) break;
+      pending.push_back({size_record, QRect(0, 0, width, height), QImage()});
+    } else if (type == tile_record) {
+      qint32 x, y, width, height;
+      QByteArray data;
+      in >> x >> y >> width >> height >> data;
+      if (in.status() != QDataStream::Ok || width <= 0 || height <= 0) break;
+
+      const QByteArray rows = qUncompress(data);
+      if (rows.size() != width * height * int(sizeof(QRgb))) break;
+      QImage pixels(width, height, QImage::Format_ARGB32);
+      const int row_bytes = width * sizeof(QRgb);
+      for (int row = 0; row < height; ++row)
+        memcpy(pixels.scanLine(row), rows.constData() + row * row_bytes,
+               row_bytes);
+      pending.push_back({tile_record, QRect(x, y, width, height), pixels});
+    } else if (type == color_record) {
+      qint32 x, y, width, height;
+      quint32 color;
+      in >> x >> y >> width >> height >> color;
+      if (in.status() != QDataStream::Ok || width <= 0 || height <= 0) break;
+      pending.push_back(
+          {color_record, QRect(x, y, width, height), QImage(), color});
+    } else if (type == checkpoint_record) {
+      for (const Queued& queued : pending) {
+        if (queued.type == size_record) {
+          picture = TiledImage(queued.rect.width(), queued.rect.height(),
+                               qRgb(255, 255, 255));
+        } else if (picture.isNull() ||
+                   !picture.rect().contains(queued.rect)) {
+          continue;
+        } else if (queued.type == color_record) {
+          picture.fillRect(queued.rect, queued.color);
+        } else {
+          picture.paste(queued.rect.topLeft(), queued.pixels);
+        }
+      }
+      pending.clear();
+    } else {
+      break;
+    }
+  }
+
+  return picture;
+}
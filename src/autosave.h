@@ -0,0 +1,71 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <QtWidgets>
+#include "tiledimage.h"
+
+// Writes changed tiles of the canvas to a journal file on its own thread, so
+// a picture can be recovered after a crash or a freeze. Records are appended
+// and flushed as they come; a checkpoint closes a set of them and recovery
+// applies only whole checkpoints, so a torn end of the file is ignored. When
+// the file grows to a few times the picture it is rewritten, atomically, as a
+// single checkpoint holding the whole picture. Tiles of a single colour are
+// written as that colour only.
+class Autosave : public QThread {
+  Q_OBJECT
+ public:
+  static const int TILE_SIZE = 64;
+
+  // `_lock` guards the file against other instances, it is held until the
+  // file is removed
+  Autosave(QString _file_name, QLockFile* _lock, QObject* parent = 0);
+  virtual ~Autosave();  // the session ended normally, so the file is removed
+
+  // called by the GUI thread, they only queue records
+  void resize(QSize size);  // the picture starts over
+  void append(QRect rect, QImage pixels);
+  void checkpoint();
+
+  static QString defaultFileName();
+  // tiled, so pictures too big for a single image are recovered as well;
+  // null when there is nothing
+  static TiledImage recover(QString file_name);
+
+ protected:
+  virtual void run() override;
+
+ private:
+  enum Record : quint8 {
+    size_record,
+    tile_record,
+    checkpoint_record,
+    color_record  // tile of a single colour
+  };
+  struct Queued {
+    Record type;
+    QRect rect;  // size of the picture for size records
+    QImage pixels;
+    QRgb color;  // of colour records
+  };
+
+  QScopedPointer<QLockFile> lock;
+  QString file_name;
+  QFile file;
+  QDataStream stream;
+  QSize size;
+  qint64 written = 0;  // bytes of tiles since the file was compacted
+
+  QMutex queue_mutex;
+  QWaitCondition queue_changed;
+  QQueue<Queued> queue;
+  bool quitting = false;
+
+  void enqueue(const Queued& queued);
+  bool open(bool truncate);
+  void write(const Queued& queued);
+  void compact();
+  static void writeHeader(QDataStream& out);
+  static bool writeTile(QDataStream& out, QRect rect, const QImage& pixels);
+};
+
+#endif  // AUTOSAVE_H
@@ -0,0 +1,280 @@
+#include "batch.h"
+#include <atomic>
+
+// names of enum values accepted in pipelines, in order of the enums
+static const QStringList LINE_TYPES = {"bresenham", "antialiased"};
+static const QStringList CIRCLE_TYPES = {"bresenham", "approximated"};
+static const QStringList FILL_TYPES = {"scanline", "stack", "recursive"};
+static const QStringList INTERPOLATION_TYPES = {"nearest", "bilinear"};
+
+// one image, run by a worker of the pool
+class BatchTask : public QRunnable {
+ public:
+  BatchTask(const Batch* _batch, QString _input_file, QString _output_file,
+            std::atomic<int>* _failed)
+      : batch(_batch),
+        input_file(_input_file),
+        output_file(_output_file),
+        failed(_failed) {}
+
+  virtual void run() override {
+    if (!batch->process(input_file, output_file)) ++*failed;
+  }
+
+ private:
+  const Batch* batch;
+  QString input_file;
+  QString output_file;
+  std::atomic<int>* failed;
+};
+
+int Batch::main(const QStringList& arguments) {
+  // arguments[0] is the program, arguments[1] is --batch
+  if (arguments.size() < 5 || arguments.size() > 6) {
+    qWarning() << "Usage:" << arguments.value(0)
+               << "--batch <pipeline> <input dir> <output dir> [threads]";
+    return 2;
+  }
+
+  int threads = QThread::idealThreadCount();
+  if (arguments.size() == 6) {
+    bool ok = false;
+    threads = arguments[5].toInt(&ok);
+    if (!ok || threads < 1) {
+      qWarning() << "Invalid number of threads:" << arguments[5];
+      return 2;
+    }
+  }
+
+  Batch batch;
+  if (!batch.parse(arguments[2])) return 2;
+
+  return batch.run(arguments[3], arguments[4], threads);
+}
+
+bool Batch::parse(QString pipeline) {
+  steps.clear();
+  for (const QString& step : pipeline.split(';', QString::SkipEmptyParts)) {
+    const QStringList words = step.simplified().split(' ');
+    if (words[0].isEmpty()) continue;
+    if (!parseStep(words)) {
+      qWarning() << "Invalid pipeline step:" << step.simplified();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// numbers and colours are told apart by their syntax, flags by their names
+bool Batch::parseStep(const QStringList& words) {
+  const QString name = words[0].toLower();
+  QStringList args = words.mid(1);
+  const bool in_place = args.removeAll("inplace") > 0;
+  const bool shears = args.removeAll("shears") > 0;
+
+  QVector<qreal> numbers;
+  QVector<QRgb> colors;
+  int type = -1;
+  for (const QString& arg : args) {
+    bool ok = false;
+    const qreal number = arg.toDouble(&ok);
+    if (ok) {
+      numbers.push_back(number);
+      continue;
+    }
+
+    const QStringList* types = name == "linetype"        ? &LINE_TYPES
+                               : name == "circletype"    ? &CIRCLE_TYPES
+                               : name == "filltype"      ? &FILL_TYPES
+                               : name == "interpolation" ? &INTERPOLATION_TYPES
+                                                         : nullptr;
+    if (types != nullptr && types->contains(arg.toLower())) {
+      type = types->indexOf(arg.toLower());
+      continue;
+    }
+
+    const QColor color(arg);
+    if (!color.isValid()) return false;
+    colors.push_back(color.rgba());
+  }
+
+  auto expect = [&](int number_count, int color_count) {
+    return numbers.size() == number_count && colors.size() == color_count;
+  };
+  auto point = [&](int i) {
+    return QPoint(qRound(numbers[i]), qRound(numbers[i + 1]));
+  };
+  auto points = [&]() {
+    QVector<QPoint> result;
+    for (int i = 0; i + 1 < numbers.size(); i += 2) result.push_back(point(i));
+    return result;
+  };
+
+  Step step;
+  if (name == "color" && expect(0, 1)) {
+    const QRgb color = colors[0];
+    step = [color](Drawer& drawer) { drawer.setMainColor(color); };
+  } else if (name == "linetype" && type >= 0 && expect(0, 0)) {
+    step = [type](Drawer& drawer) { drawer.setLineType(LineType(type)); };
+  } else if (name == "circletype" && type >= 0 && expect(0, 0)) {
+    step = [type](Drawer& drawer) { drawer.setCircleType(CircleType(type)); };
+  } else if (name == "circlesteps" && expect(1, 0)) {
+    const int circle_steps = qRound(numbers[0]);
+    step = [circle_steps](Drawer& drawer) {
+      drawer.setCircleSteps(circle_steps);
+    };
+  } else if (name == "filltype" && type >= 0 && expect(0, 0)) {
+    step = [type](Drawer& drawer) { drawer.setFillType(FillType(type)); };
+  } else if (name == "interpolation" && type >= 0 && expect(0, 0)) {
+    step = [type](Drawer& drawer) {
+      drawer.setInterpolationType(InterpolationType(type));
+    };
+  } else if (name == "point" && expect(2, 0)) {
+    const QPoint p = point(0);
+    step = [p](Drawer& drawer) { drawer.drawPoint(p); };
+  } else if (name == "line" && expect(4, 0)) {
+    const QPoint start = point(0);
+    const QPoint end = point(2);
+    step = [start, end](Drawer& drawer) { drawer.drawLine(start, end); };
+  } else if (name == "circle" && expect(3, 0)) {
+    const QPoint centre = point(0);
+    const QPoint range = centre + QPoint(qRound(numbers[2]), 0);
+    step = [centre, range](Drawer& drawer) {
+      drawer.drawCircle(centre, range);
+    };
+  } else if (name == "polyline" && numbers.size() >= 2 &&
+             numbers.size() % 2 == 0 && expect(numbers.size(), 0)) {
+    const QVector<QPoint> polyline = points();
+    step = [polyline](Drawer& drawer) { drawer.drawPolyline(polyline); };
+  } else if (name == "polygon" && numbers.size() >= 6 &&
+             numbers.size() % 2 == 0 && expect(numbers.size(), 0)) {
+    QVector<QPoint> polygon = points();
+    step = [polygon](Drawer& drawer) mutable { drawer.drawPolygon(polygon); };
+  } else if (name == "spline" && numbers.size() >= 8 &&
+             numbers.size() % 2 == 0 && expect(numbers.size(), 0)) {
+    QVector<QPoint> spline = points();
+    step = [spline](Drawer& drawer) mutable { drawer.drawBasisSpline(spline); };
+  } else if (name == "bezier" && expect(8, 0)) {
+    const QVector<QPoint> p = points();
+    step = [p](Drawer& drawer) {
+      drawer.drawBezierCurve(p[0], p[1], p[2], p[3]);
+    };
+  } else if (name == "fill" && expect(2, 1)) {
+    const QPoint start = point(0);
+    const QRgb color = colors[0];
+    step = [start, color](Drawer& drawer) { drawer.fill(start, color); };
+  } else if ((name == "hgradient" || name == "vgradient") && expect(1, 2)) {
+    const bool horizontal = name == "hgradient";
+    const QRgb start_color = colors[0];
+    const QRgb end_color = colors[1];
+    const int gradient_steps = qRound(numbers[0]);
+    step = [horizontal, start_color, end_color,
+            gradient_steps](Drawer& drawer) {
+      if (horizontal)
+        drawer.paintHorizontalGradient(start_color, end_color, gradient_steps);
+      else
+        drawer.paintVerticalGradient(start_color, end_color, gradient_steps);
+    };
+  } else if (name == "shift" && expect(2, 0)) {
+    const QPoint shift = point(0);
+    step = [shift](Drawer& drawer) {
+      drawer.transform(drawer.createShiftMatrix(shift.x(), shift.y()));
+    };
+  } else if (name == "rotate" && expect(1, 0)) {
+    const qreal angle = numbers[0];
+    step = [angle, in_place, shears](Drawer& drawer) {
+      if (shears)
+        drawer.rotateThreeShear(angle, in_place);
+      else
+        drawer.transform(drawer.createRotateMatrix(angle, in_place));
+    };
+  } else if (name == "scale" && expect(2, 0)) {
+    const qreal x = numbers[0];
+    const qreal y = numbers[1];
+    step = [x, y, in_place](Drawer& drawer) {
+      drawer.transform(drawer.createScaleMatrix(x, y, in_place));
+    };
+  } else if (name == "shear" && expect(2, 0)) {
+    const qreal x = numbers[0];
+    const qreal y = numbers[1];
+    step = [x, y, in_place](Drawer& drawer) {
+      drawer.transform(drawer.createShearMatrix(x, y, in_place));
+    };
+  }
+
+  if (!step) return false;
+  steps.push_back(step);
+
+  return true;
+}
+
+int Batch::run(QString input_dir, QString output_dir, int threads) {
+  QStringList filters;
+  for (const QByteArray& format : QImageReader::supportedImageFormats())
+    filters << "*." + QString(format);
+
+  const QDir input(input_dir);
+  const QStringList files = input.entryList(filters, QDir::Files, QDir::Name);
+  if (!input.exists() || !QDir().mkpath(output_dir)) {
+    qWarning() << "Cannot use directories" << input_dir << output_dir;
+    return 1;
+  }
+  const QDir output(output_dir);
+
+  QElapsedTimer timer;
+  timer.start();
+
+  // tasks only hold file names until a worker takes them
+  QThreadPool pool;
+  pool.setMaxThreadCount(threads);
+  std::atomic<int> failed(0);
+  for (const QString& file : files) {
+    const QString input_file = input.filePath(file);
+    const QString output_file = output.filePath(file);
+    pool.start(new BatchTask(this, input_file, output_file, &failed));
+  }
+  pool.waitForDone();
+
+  const qreal seconds = qMax(timer.elapsed(), qint64(1)) / 1000.0;
+  qDebug().nospace() << files.size() << " images (" << failed << " failed) in "
+                     << seconds << " s with " << threads << " threads: "
+                     << files.size() / seconds << " images/s";
+
+  return failed > 0 ? 1 : 0;
+}
+
+// each worker thread keeps its drawer, so maps of transformations of images
+// of the same size are computed only once
+bool Batch::process(QString input_file, QString output_file) const {
+  static QThreadStorage<Drawer*> drawers;
+  if (!drawers.hasLocalData()) drawers.setLocalData(new Drawer());
+  Drawer& drawer = *drawers.localData();
+
+  QImage image = Drawer::toWorkingFormat(QImage(input_file));
+  if (image.isNull()) {
+    qWarning() << "Image has not been loaded successfully:" << input_file;
+    return false;
+  }
+
+  // every image starts from the defaults, whatever the previous one set
+  const Settings defaults;
+  drawer.setImage(&image);
+  drawer.setMainColor(defaults.main_color.rgba());
+  drawer.initialize(defaults.line_type, defaults.circle_type,
+                    defaults.circle_steps, defaults.fill_type,
+                    defaults.interpolation_type);
+  drawer.setTransformTiling(defaults.transform_tile_size,
+                            defaults.transform_prefetch);
+  drawer.setTransformCache(defaults.transform_cache_size);
+
+  for (const Step& step : steps) step(drawer);
+  drawer.resetDirtyRegion();
+
+  if (!image.save(output_file)) {
+    qWarning() << "Image has not been saved successfully:" << output_file;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <QtWidgets>
+#include <functional>
+#include "drawer.h"
+
+// Applies a pipeline of operations to every image of a directory, without
+// any window. Images are processed in parallel, each worker thread loading,
+// changing and saving one image at a time, so memory is bounded by the number
+// of threads while reading, drawing and writing of different images overlap.
+//
+// Pipeline is a list of steps separated by semicolons, for example
+//   "interpolation bilinear; rotate 30 inplace; color #ff0000; line 0 0 99 99"
+class Batch {
+ public:
+  typedef std::function<void(Drawer&)> Step;
+
+  // handles `--batch <pipeline> <input dir> <output dir> [threads]`
+  static int main(const QStringList& arguments);
+
+  bool parse(QString pipeline);  // false (with a warning) on errors
+  int run(QString input_dir, QString output_dir, int threads);  // exit code
+  bool process(QString input_file, QString output_file) const;
+
+ private:
+  QVector<Step> steps;
+
+  bool parseStep(const QStringList& words);
+};
+
+#endif  // BATCH_H
@@ -2,25 +2,166 @@
 
 Canvas::Canvas(QWidget* parent) : QWidget(parent) {
   settings = Settings();
-  image = QImage(settings.width, settings.height, QImage::Format_ARGB32);
 
   setFocusPolicy(Qt::FocusPolicy::StrongFocus);
   resize(settings.width, settings.height);
 
-  drawer = Drawer(&image, settings.main_color.rgba());
-  drawer.initialize(settings.line_type, settings.circle_type,
-                    settings.circle_steps, settings.fill_type,
-                    settings.interpolation_type);
+  mipmaps.setImage(&image);
+
+  // frames of the render thread and repaints they cause are both merged and
+  // taken at most once per display frame
+  repaint = new RepaintScheduler(this, settings.frame_rate);
+
+  // moves of a stroke are gathered and drawn together once per frame
+  stroke_timer.setSingleShot(true);
+  stroke_timer.setInterval(repaint->interval());
+  connect(&stroke_timer, &QTimer::timeout, this, &Canvas::flushStroke);
+
+  // pixels are owned and changed by the render thread, canvas displays
+  // copies of them handed over in frames
+  connect(&render_thread, &RenderThread::saveStarted, this,
+          &Canvas::saveStarted);
+  connect(&render_thread, &RenderThread::saveFinished, this,
+          &Canvas::saveFinished);
+  connect(&render_thread, &RenderThread::frameReady, repaint,
+          [this]() { repaint->request(); });
+  connect(repaint, &RepaintScheduler::flushing, this, &Canvas::redraw);
+  createProgressDialog();
+  render_thread.start();
+
+  const Settings initial = settings;
+  render_thread.submit([initial](Drawer& drawer) {
+    drawer.setMainColor(initial.main_color.rgba());
+    drawer.initialize(initial.line_type, initial.circle_type,
+                      initial.circle_steps, initial.fill_type,
+                      initial.interpolation_type);
+    drawer.setTransformTiling(initial.transform_tile_size,
+                              initial.transform_prefetch);
+    drawer.setTransformCache(initial.transform_cache_size);
+  });
+  render_thread.setUndoHistory(settings.undo_budget,
+                               settings.undo_compression);
+  render_thread.setCanvasSize(settings.width, settings.height,
+                              Qt::GlobalColor::white);
 
   // TODO support settings.clear_color
   clear(QColor(130, 51, 214, 255));
 }
 
-void Canvas::paintEvent(QPaintEvent*) {
+// shown only for commands running longer than settings.progress_threshold
+void Canvas::createProgressDialog() {
+  progress = new QProgressDialog(this);
+  progress->setWindowTitle(tr("Working"));
+  progress->setWindowModality(Qt::NonModal);
+  progress->setMinimumDuration(settings.progress_threshold);
+  progress->reset();
+
+  connect(progress, &QProgressDialog::canceled, this,
+          [this]() { render_thread.cancel(); });
+  connect(&render_thread, &RenderThread::commandStarted, this,
+          [this](QString name) {
+            progress->setLabelText(name.isEmpty() ? tr("Drawing") : name);
+            progress->setValue(0);
+          });
+  connect(&render_thread, &RenderThread::progressChanged, progress,
+          &QProgressDialog::setValue);
+  connect(&render_thread, &RenderThread::commandFinished, this,
+          [this](QString name, bool cancelled) {
+            progress->reset();
+            if (cancelled) qDebug() << "Cancelled:" << name;
+          });
+}
+
+void Canvas::paintEvent(QPaintEvent* e) {
   QPainter painter(this);
+  const qreal zoom = settings.zoom;
+  const QRect exposed = e->rect();
+
+  if (!preview.isNull()) {
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+    painter.drawImage(QRectF(0, 0, settings.width * zoom,
+                             settings.height * zoom),
+                      preview);
+  } else if (!tiles.isNull()) {
+    // tiles render only the visible part, at any zoom
+    const QRect area = exposed & QRect(0, 0, tiles.width() * zoom,
+                                       tiles.height() * zoom);
+    if (!area.isEmpty())
+      painter.drawImage(area.topLeft(), tiles.render(area, zoom));
+  } else if (zoom < 1) {
+    updateScaledImage();
+    painter.drawImage(exposed.topLeft(), image_scaled, exposed);
+  } else {
+    // magnify only source pixels under exposed part of the widget (usually
+    // the viewport of scroll area), each of them as a block of zoom x zoom
+    image_scaled = QImage();
+    QRect source(
+        QPoint(floor(exposed.left() / zoom), floor(exposed.top() / zoom)),
+        QPoint(ceil((exposed.right() + 1) / zoom) - 1,
+               ceil((exposed.bottom() + 1) / zoom) - 1));
+    source &= image.rect();
+
+    QRectF target(source.x() * zoom, source.y() * zoom,
+                  source.width() * zoom, source.height() * zoom);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, false);
+    if (!source.isEmpty()) painter.drawImage(target, image, source);
+  }
+
+  if (settings.grid) drawGrid(painter, exposed);
+}
+
+// grid is drawn over the image in widget coordinates, so it never changes
+// pixels of the image and costs the same at any image size
+void Canvas::drawGrid(QPainter& painter, QRect exposed) {
+  const qreal zoom = settings.zoom;
+  const int spacing = 100;  // in image pixels
+  const QRect canvas = canvasRect();
+  const QRect area = exposed & QRect(0, 0, canvas.width() * zoom,
+                                     canvas.height() * zoom);
+  if (area.isEmpty()) return;
+
+  painter.setPen(QPen(settings.debug_color, 0));  // cosmetic, always 1 pixel
+  painter.setClipRect(area);
+
+  for (int k = ceil(area.left() / (spacing * zoom));
+       k * spacing * zoom <= area.right(); ++k) {
+    const int x = k * spacing * zoom;
+    painter.drawLine(x, area.top(), x, area.bottom());
+  }
+  for (int k = ceil(area.top() / (spacing * zoom));
+       k * spacing * zoom <= area.bottom(); ++k) {
+    const int y = k * spacing * zoom;
+    painter.drawLine(area.left(), y, area.right(), y);
+  }
+}
 
-  painter.drawImage(0, 0, image.scaled(image.width() * settings.zoom,
-                                       image.height() * settings.zoom));
+// rescales only parts of the image that changed since previous paint; used
+// when zoomed out, so the scaled image is never bigger than the original
+void Canvas::updateScaledImage() {
+  const qreal zoom = settings.zoom;
+  const QSize size(image.width() * zoom, image.height() * zoom);
+  if (image_scaled.size() != size) {
+    image_scaled = QImage(size, QImage::Format_ARGB32);
+    scaled_dirty = image.rect();
+  }
+  if (scaled_dirty.isEmpty()) return;
+
+  // zoomed out display scales down a smaller copy of the image
+  const int n = mipmaps.levelFor(1 / zoom);
+  const QImage& source = mipmaps.level(n);
+  const qreal level_scale = 1.0 / (1 << n);
+
+  QPainter painter(&image_scaled);
+  painter.setCompositionMode(QPainter::CompositionMode_Source);
+  for (const QRect& rect : scaled_dirty) {
+    QRectF target(rect.x() * zoom, rect.y() * zoom, rect.width() * zoom,
+                  rect.height() * zoom);
+    QRectF source_rect(rect.x() * level_scale, rect.y() * level_scale,
+                       rect.width() * level_scale, rect.height() * level_scale);
+    painter.drawImage(target, source, source_rect);
+  }
+
+  scaled_dirty = QRegion();
 }
 
 void Canvas::mousePressEvent(QMouseEvent* e) {
@@ -38,26 +179,129 @@ void Canvas::mouseMoveEvent(QMouseEvent* e) {
     processMousePress(e->pos().x() / settings.zoom,
                       e->pos().y() / settings.zoom);
   }
+
+  if (settings.mode == Mode::stroke && e->buttons() == Qt::LeftButton) {
+    stroke_points.push_back(QPoint(e->pos().x() / settings.zoom,
+                                   e->pos().y() / settings.zoom));
+    if (!stroke_timer.isActive()) stroke_timer.start();
+  }
 }
 
+void Canvas::mouseReleaseEvent(QMouseEvent* e) {
+  if (settings.mode == Mode::stroke && e->button() == Qt::LeftButton) {
+    flushStroke();
+    stroke_points.clear();
+  }
+}
+
+// draws points gathered since the previous frame as one polyline continuing
+// from the last drawn point, so that fast strokes have no gaps
+void Canvas::flushStroke() {
+  stroke_timer.stop();
+  if (stroke_points.size() < 2) return;
+
+  const QVector<QPoint> polyline = stroke_points;
+  journal.recordStroke(settings, polyline);
+  render_thread.submit(
+      [polyline](Drawer& drawer) { drawer.drawPolyline(polyline); },
+      QString(), true);  // whole stroke is undone at once
+  stroke_points = {polyline.last()};
+}
+
+// copies pixels finished by the render thread since previous redraw and
+// repaints only them
 void Canvas::redraw() {
-  update();
-  // TODO make grid drawn on widget placed over canvas
-  if (settings.grid) {
-    for (int y = 0; y < settings.height; ++y) {
-      for (int x = 0; x < settings.width; ++x) {
-        if (!(x % 100) || !(y % 100))
-          image.setPixel(x, y, settings.debug_color.rgba());
-      }
-    }
+  RenderFrame frame = render_thread.takeFrame();
+
+  // replays close (and delete) themselves
+  for (const StepTrace& trace : frame.traces)
+    new DebugWindow(trace, settings.frame_rate);
+
+  // preview of a picture being loaded stands for the canvas until its pixels
+  // arrive; it is stretched when painted
+  if (!frame.preview.isNull() && frame.rects.isEmpty()) {
+    preview = frame.preview;
+    settings.width = frame.size.width();
+    settings.height = frame.size.height();
+    image_scaled = QImage();
+    resize(settings.width * settings.zoom, settings.height * settings.zoom);
+    repaint->requestAll();
+    return;
+  }
+  if (frame.rects.isEmpty()) return;
+  preview = QImage();
+
+  settings.tiled = frame.tiled;  // render thread may refuse to switch
+  if (frame.tiled) {
+    tiles = frame.tiles;
+    image = QImage();
+  } else {
+    tiles = TiledImage();
+    if (image.size() != frame.size)
+      image = Drawer::createAlignedImage(frame.size.width(),
+                                         frame.size.height());
+
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int i = 0; i < frame.rects.size(); ++i)
+      painter.drawImage(frame.rects[i].topLeft(), frame.patches[i]);
+  }
+
+  if (frame.size != QSize(settings.width, settings.height)) {
+    settings.width = frame.size.width();
+    settings.height = frame.size.height();
+    image_scaled = QImage();
+    resize(settings.width * settings.zoom, settings.height * settings.zoom);
   }
+
+  for (const QRect& rect : frame.rects) invalidate(rect);
+  if (autosave != nullptr)
+    for (const QRect& rect : frame.rects) autosave_dirty += rect;
+}
+
+// `rect` is in image coordinates
+void Canvas::invalidate(QRect rect) {
+  rect &= canvasRect();
+  if (rect.isEmpty()) return;
+
+  if (tiles.isNull()) {
+    mipmaps.invalidate(rect);
+    scaled_dirty += rect;
+  }
+
+  const qreal zoom = settings.zoom;
+  repaint->request(
+      QRect(QPoint(floor(rect.left() * zoom), floor(rect.top() * zoom)),
+            QPoint(ceil((rect.right() + 1) * zoom),
+                   ceil((rect.bottom() + 1) * zoom))));
+}
+
+QRect Canvas::canvasRect() const {
+  return tiles.isNull() ? image.rect() : tiles.rect();
 }
 
 // accepts converted click coordinates (not raw data)
 void Canvas::processMousePress(int pos_x, int pos_y) {
+  // random fill colour is picked before recording and recorded as a fixed
+  // one, so replays fill with the same colours
+  Settings recorded = settings;
+  if (settings.mode == Mode::fill && settings.fill_random) {
+    settings.fill_color =
+        QColor(rand() % 255, rand() % 255, rand() % 255, rand() % 255);
+    recorded.fill_color = settings.fill_color;
+    recorded.fill_random = false;
+  }
+  journal.recordPress(recorded, QPoint(pos_x, pos_y));
   switch (settings.mode) {
     case Mode::click: {
-      drawer.drawPoint(pos_x, pos_y);
+      render_thread.submit(
+          [pos_x, pos_y](Drawer& drawer) { drawer.drawPoint(pos_x, pos_y); });
+    } break;
+
+    case Mode::stroke: {
+      stroke_points = {QPoint(pos_x, pos_y)};
+      render_thread.submit(
+          [pos_x, pos_y](Drawer& drawer) { drawer.drawPoint(pos_x, pos_y); });
     } break;
 
     case Mode::line: {
@@ -65,7 +309,9 @@ void Canvas::processMousePress(int pos_x, int pos_y) {
         points.push_back(QPoint(pos_x, pos_y));
       }
       if (points.size() == 2) {
-        drawer.drawLine(points[0], points[1]);
+        const QPoint a = points[0], b = points[1];
+        render_thread.submit(
+            [a, b](Drawer& drawer) { drawer.drawLine(a, b); });
         setDefaultMode();
       }
     } break;
@@ -75,7 +321,9 @@ void Canvas::processMousePress(int pos_x, int pos_y) {
         points.push_back(QPoint(pos_x, pos_y));
       }
       if (points.size() == 2) {
-        drawer.drawCircle(points[0], points[1]);
+        const QPoint a = points[0], b = points[1];
+        render_thread.submit(
+            [a, b](Drawer& drawer) { drawer.drawCircle(a, b); });
         setDefaultMode();
       }
     } break;
@@ -85,7 +333,10 @@ void Canvas::processMousePress(int pos_x, int pos_y) {
         points.push_back(QPoint(pos_x, pos_y));
       }
       if (points.size() == 4) {
-        drawer.drawBezierCurve(points[0], points[1], points[2], points[3]);
+        const QVector<QPoint> p = points;
+        render_thread.submit([p](Drawer& drawer) {
+          drawer.drawBezierCurve(p[0], p[1], p[2], p[3]);
+        });
         setDefaultMode();
       }
     } break;
@@ -103,17 +354,16 @@ void Canvas::processMousePress(int pos_x, int pos_y) {
     } break;
 
     case Mode::fill: {
-      if (settings.fill_random) {
-        settings.fill_color =
-            QColor(rand() % 255, rand() % 255, rand() % 255, rand() % 255);
-      }
-      drawer.fill(QPoint(pos_x, pos_y), settings.fill_color.rgba());
+      const QRgb color = settings.fill_color.rgba();
+      render_thread.submit(
+          [pos_x, pos_y, color](Drawer& drawer) {
+            drawer.fill(QPoint(pos_x, pos_y), color);
+          },
+          tr("Filling"));
     } break;
 
     case Mode::none:
     default: { } break; }
-
-  redraw();
 }
 
 void Canvas::setMode(Mode _mode) {
@@ -128,57 +378,86 @@ void Canvas::setDefaultMode() {
   qDebug() << "Resetting mode";
   setMode(Mode::none);
   emit changedToDefaultMode();  // updates menu labels in main window
-  redraw();  // update widget, since it means some action has been completed
 }
 
 void Canvas::applyOperation(Operation operation) {
   qDebug() << "Applying operation:" << int(operation);
+  journal.recordOperation(settings, operation);
+  const Settings current = settings;  // command runs later
+  RenderThread::Command command;
+  QString name;
   switch (operation) {
     case Operation::hgradient: {
-      drawer.paintHorizontalGradient(settings.start_color.rgba(),
-                                     settings.end_color.rgba(),
-                                     settings.gradient_steps);
+      name = tr("Painting gradient");
+      command = [current](Drawer& drawer) {
+        drawer.paintHorizontalGradient(current.start_color.rgba(),
+                                       current.end_color.rgba(),
+                                       current.gradient_steps);
+      };
     } break;
 
     case Operation::vgradient: {
-      drawer.paintVerticalGradient(settings.start_color.rgba(),
-                                   settings.end_color.rgba(),
-                                   settings.gradient_steps);
+      name = tr("Painting gradient");
+      command = [current](Drawer& drawer) {
+        drawer.paintVerticalGradient(current.start_color.rgba(),
+                                     current.end_color.rgba(),
+                                     current.gradient_steps);
+      };
     } break;
 
     case Operation::shift: {
-      drawer.transform(
-          drawer.createShiftMatrix(settings.shift_x, settings.shift_y));
+      name = tr("Shifting");
+      command = [current](Drawer& drawer) {
+        drawer.transform(
+            drawer.createShiftMatrix(current.shift_x, current.shift_y));
+      };
     } break;
 
     case Operation::rotate: {
-      drawer.transform(drawer.createRotateMatrix(settings.rotate_angle,
-                                                 settings.rotate_inplace));
+      name = tr("Rotating");
+      command = [current](Drawer& drawer) {
+        if (current.rotation_type == RotationType::shears)
+          drawer.rotateThreeShear(current.rotate_angle, current.rotate_inplace);
+        else
+          drawer.transform(drawer.createRotateMatrix(current.rotate_angle,
+                                                     current.rotate_inplace));
+      };
     } break;
 
     case Operation::scale: {
-      drawer.transform(drawer.createScaleMatrix(
-          settings.scale_x, settings.scale_y, settings.scale_inplace));
+      name = tr("Scaling");
+      command = [current](Drawer& drawer) {
+        drawer.transform(drawer.createScaleMatrix(
+            current.scale_x, current.scale_y, current.scale_inplace));
+      };
     } break;
 
     case Operation::shear: {
-      drawer.transform(drawer.createShearMatrix(
-          settings.shear_x, settings.shear_y, settings.shear_inplace));
+      name = tr("Shearing");
+      command = [current](Drawer& drawer) {
+        drawer.transform(drawer.createShearMatrix(
+            current.shear_x, current.shear_y, current.shear_inplace));
+      };
     } break;
   }
 
-  redraw();
+  if (command) render_thread.submit(command, name);
 }
 
 void Canvas::applySetupDraw() {
+  journal.recordSetupDraw(settings);
   switch (settings.mode) {
     case Mode::polygon: {
-      drawer.drawPolygon(points);
+      QVector<QPoint> p = points;
+      render_thread.submit(
+          [p](Drawer& drawer) mutable { drawer.drawPolygon(p); });
       setDefaultMode();
     } break;
 
     case Mode::spline: {
-      drawer.drawBasisSpline(points);
+      QVector<QPoint> p = points;
+      render_thread.submit(
+          [p](Drawer& drawer) mutable { drawer.drawBasisSpline(p); });
       setDefaultMode();
     } break;
 
@@ -186,45 +465,58 @@ void Canvas::applySetupDraw() {
   }
 }
 
-void Canvas::loadFile(QString file_name) {
+void Canvas::loadFile(QString file_name, QRect clip) {
   // TODO check permissions to read
-  image = QImage(file_name);
-
-  drawer = Drawer(&image, settings.main_color.rgba());
-  drawer.initialize(settings.line_type, settings.circle_type,
-                    settings.circle_steps, settings.fill_type,
-                    settings.interpolation_type);
-
-  update();
+  // canvas takes size of the image once its frame arrives
+  journal.recordLoad(file_name, clip);
+  render_thread.loadFile(file_name, clip);
 }
 
 void Canvas::saveFile(QString file_name) {
   // TODO check permissions to read
-  // 0 = try to guess extension; 100 = best quality
-  bool successful = image.save(file_name, 0, -1);
-  if (!successful) qWarning() << "Image has not been saved successfully";
+  render_thread.saveFile(file_name, settings.save_quality);
 }
 
 void Canvas::setDebug(bool _debug) {
   settings.debug = _debug;
-  drawer.setDebug(_debug, settings.debug_color.rgba());
+  const QRgb color = settings.debug_color.rgba();
+  render_thread.submit(
+      [_debug, color](Drawer& drawer) { drawer.setDebug(_debug, color); });
+}
+
+void Canvas::switchGrid() {
+  settings.grid = !(settings.grid);
+  repaint->requestAll();
 }
 
-void Canvas::switchGrid() { settings.grid = !(settings.grid); }
+void Canvas::setTiled(bool _tiled) {
+  settings.tiled = _tiled;
+  journal.recordTiled(_tiled);
+  render_thread.setTiled(_tiled);
+}
+
+// keeps the top left part of the picture, new area is white
+void Canvas::setCanvasSize(int _width, int _height) {
+  journal.recordResize(_width, _height);
+  render_thread.setCanvasSize(_width, _height, Qt::GlobalColor::white);
+}
 
 void Canvas::setZoom(qreal _zoom) {
   settings.zoom = _zoom;
-  resize(800 * _zoom, 800 * _zoom);
+  scaled_dirty = canvasRect();
+  resize(settings.width * _zoom, settings.height * _zoom);
 }
 
 void Canvas::setLineType(LineType _line_type) {
   settings.line_type = _line_type;
-  drawer.setLineType(_line_type);
+  render_thread.submit(
+      [_line_type](Drawer& drawer) { drawer.setLineType(_line_type); });
 }
 
 void Canvas::setCircleType(CircleType _circle_type) {
   settings.circle_type = _circle_type;
-  drawer.setCircleType(_circle_type);
+  render_thread.submit(
+      [_circle_type](Drawer& drawer) { drawer.setCircleType(_circle_type); });
 }
 
 void Canvas::setFillSettings(bool _fill_random, QColor _fill_color,
@@ -232,7 +524,8 @@ void Canvas::setFillSettings(bool _fill_random, QColor _fill_color,
   settings.fill_random = _fill_random;
   settings.fill_color = _fill_color;
   settings.fill_type = _fill_type;
-  drawer.setFillType(_fill_type);
+  render_thread.submit(
+      [_fill_type](Drawer& drawer) { drawer.setFillType(_fill_type); });
 }
 
 void Canvas::setGradientSettings(QColor _start_color, QColor _end_color,
@@ -244,17 +537,24 @@ void Canvas::setGradientSettings(QColor _start_color, QColor _end_color,
 
 void Canvas::setMainColor(QColor _main_color) {
   settings.main_color = _main_color;
-  drawer.setMainColor(_main_color.rgba());
+  const QRgb color = _main_color.rgba();
+  render_thread.submit([color](Drawer& drawer) { drawer.setMainColor(color); });
 }
 
 void Canvas::setCircleSteps(int _circle_steps) {
   settings.circle_steps = _circle_steps;
-  drawer.setCircleSteps(_circle_steps);
+  render_thread.submit([_circle_steps](Drawer& drawer) {
+    drawer.setCircleSteps(_circle_steps);
+  });
 }
 
 void Canvas::setDebugColor(QColor _debug_color) {
   settings.debug_color = _debug_color;
-  drawer.setDebug(settings.debug, _debug_color.rgba());
+  const bool debug = settings.debug;
+  const QRgb color = _debug_color.rgba();
+  render_thread.submit(
+      [debug, color](Drawer& drawer) { drawer.setDebug(debug, color); });
+  if (settings.grid) repaint->requestAll();
 }
 
 void Canvas::setShift(int _shift_x, int _shift_y) {
@@ -267,6 +567,10 @@ void Canvas::setRotate(qreal _rotation_angle, bool _rotate_inplace) {
   settings.rotate_inplace = _rotate_inplace;
 }
 
+void Canvas::setRotationType(RotationType _rotation_type) {
+  settings.rotation_type = _rotation_type;
+}
+
 void Canvas::setScale(qreal _scale_x, qreal _scale_y, bool _scale_inplace) {
   settings.scale_x = _scale_x;
   settings.scale_y = _scale_y;
@@ -281,12 +585,218 @@ void Canvas::setShear(qreal _shear_x, qreal _shear_y, bool _shear_inplace) {
 
 void Canvas::setInterpolationType(InterpolationType _interpolation_type) {
   settings.interpolation_type = _interpolation_type;
-  drawer.setInterpolationType(settings.interpolation_type);
+  render_thread.submit([_interpolation_type](Drawer& drawer) {
+    drawer.setInterpolationType(_interpolation_type);
+  });
+}
+
+void Canvas::setTransformTiling(int _tile_size, bool _prefetch) {
+  settings.transform_tile_size = _tile_size;
+  settings.transform_prefetch = _prefetch;
+  render_thread.submit([_tile_size, _prefetch](Drawer& drawer) {
+    drawer.setTransformTiling(_tile_size, _prefetch);
+  });
+}
+
+void Canvas::setTransformCache(int _megabytes) {
+  settings.transform_cache_size = _megabytes;
+  render_thread.submit(
+      [_megabytes](Drawer& drawer) { drawer.setTransformCache(_megabytes); });
 }
 
+void Canvas::setProgressThreshold(int _milliseconds) {
+  settings.progress_threshold = _milliseconds;
+  progress->setMinimumDuration(_milliseconds);
+}
+
+void Canvas::setFrameRate(int _frame_rate) {
+  settings.frame_rate = _frame_rate;
+  repaint->setRate(_frame_rate);
+  stroke_timer.setInterval(repaint->interval());
+}
+
+void Canvas::setUndoHistory(int _megabytes, bool _compress) {
+  settings.undo_budget = _megabytes;
+  settings.undo_compression = _compress;
+  render_thread.setUndoHistory(_megabytes, _compress);
+}
+
+void Canvas::undo() {
+  journal.recordUndo();
+  render_thread.undo();
+}
+
+void Canvas::redo() {
+  journal.recordRedo();
+  render_thread.redo();
+}
+
+void Canvas::setAutosaveInterval(int _seconds) {
+  settings.autosave_interval = _seconds;
+  if (autosave == nullptr) return;
+
+  if (_seconds > 0 && !autosave_timer.isActive())
+    autosave_timer.start(_seconds * 1000);
+  else if (_seconds == 0)
+    autosave_timer.stop();
+}
+
+void Canvas::setSaveQuality(int _quality) { settings.save_quality = _quality; }
+
 void Canvas::clear(QColor color) {
-  image.fill(color);
-  redraw();
+  journal.recordClear(color);
+  render_thread.clear(color);
+}
+
+// the journal of a session which did not end normally is moved aside, as
+// the new session starts its own
+bool Canvas::startAutosave() {
+  const QString file_name = Autosave::defaultFileName();
+
+  // only one instance autosaves, others would take its file for a crashed one
+  QScopedPointer<QLockFile> lock(new QLockFile(file_name + ".lock"));
+  if (!lock->tryLock(0)) {
+    qWarning() << "Autosave is disabled, another instance is using it";
+    return false;
+  }
+
+  recovery_file = file_name + ".recovered";
+  const bool crashed = QFile::exists(file_name) &&
+                       (!QFile::exists(recovery_file) ||
+                        QFile::remove(recovery_file)) &&
+                       QFile::rename(file_name, recovery_file);
+
+  autosave = new Autosave(file_name, lock.take(), this);
+  autosave->start();
+  autosave_timer.setSingleShot(true);
+  connect(&autosave_timer, &QTimer::timeout, this, &Canvas::autosaveStep);
+  setAutosaveInterval(settings.autosave_interval);
+
+  return crashed;
+}
+
+void Canvas::recover() { render_thread.recoverFile(recovery_file); }
+void Canvas::discardRecovery() { QFile::remove(recovery_file); }
+
+// copies tiles changed since the previous checkpoint for the autosave thread,
+// for about a millisecond at a time, so that the GUI thread never waits long
+void Canvas::autosaveStep() {
+  const QRect canvas_rect = canvasRect();
+  if (canvas_rect.isEmpty()) {
+    setAutosaveInterval(settings.autosave_interval);
+    return;
+  }
+  const int size = Autosave::TILE_SIZE;
+  const int columns = (canvas_rect.width() + size - 1) / size;
+  const int rows = (canvas_rect.height() + size - 1) / size;
+  if (canvas_rect.size() != autosave_size) {
+    autosave_size = canvas_rect.size();
+    autosave->resize(autosave_size);
+    autosave_dirty = canvas_rect;
+    autosave_spans.clear();
+  }
+
+  // a new checkpoint takes whole tiles covering everything changed; only
+  // spans of tiles are listed here, tiles are walked within the time budget
+  if (autosave_spans.isEmpty() && !autosave_dirty.isEmpty()) {
+    for (const QRect& rect : autosave_dirty & canvas_rect)
+      autosave_spans.push_back(
+          QRect(QPoint(rect.left() / size, rect.top() / size),
+                QPoint(rect.right() / size, rect.bottom() / size)));
+    autosave_dirty = QRegion();
+    autosave_taken.fill(false, columns * rows);
+    if (!autosave_spans.isEmpty())
+      autosave_next = autosave_spans.last().topLeft();
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  while (!autosave_spans.isEmpty() && timer.nsecsElapsed() < 1000000) {
+    const QRect span = autosave_spans.last();
+    const QPoint tile = autosave_next;
+    if (tile.x() < span.right()) {
+      autosave_next.rx()++;
+    } else if (tile.y() < span.bottom()) {
+      autosave_next = QPoint(span.left(), tile.y() + 1);
+    } else {
+      autosave_spans.removeLast();
+      if (!autosave_spans.isEmpty())
+        autosave_next = autosave_spans.last().topLeft();
+    }
+
+    // spans of a region can share tiles, each is saved once
+    const int index = tile.y() * columns + tile.x();
+    if (!autosave_taken.testBit(index)) {
+      autosave_taken.setBit(index);
+      const QRect rect =
+          QRect(tile.x() * size, tile.y() * size, size, size) & canvas_rect;
+      autosave->append(rect, tiles.isNull() ? image.copy(rect)
+                                            : tiles.render(rect, 1));
+    }
+    if (autosave_spans.isEmpty()) autosave->checkpoint();
+  }
+
+  // the rest is copied as soon as events waiting meanwhile are handled
+  if (!autosave_spans.isEmpty())
+    autosave_timer.start(0);
+  else if (settings.autosave_interval > 0)
+    autosave_timer.start(settings.autosave_interval * 1000);
+}
+
+// settings are recorded with the next event they affect; the picture the
+// session starts from is saved next to the journal and loaded by replays
+bool Canvas::startJournal(QString file_name) {
+  if (!journal.start(file_name, settings)) return false;
+
+  const QString picture =
+      QFileInfo(file_name).absoluteFilePath() + ".start.png";
+  render_thread.saveFile(picture, -1);
+  journal.recordLoad(picture, QRect());
+
+  return true;
+}
+
+void Canvas::stopJournal() { journal.stop(); }
+bool Canvas::isRecordingJournal() const { return journal.isRecording(); }
+
+// setters submit only commands that change anything
+void Canvas::applySettings(const Settings& _settings) {
+  const Settings& s = _settings;
+  if (s.mode != settings.mode) setMode(s.mode);
+  if (s.line_type != settings.line_type) setLineType(s.line_type);
+  if (s.circle_type != settings.circle_type) setCircleType(s.circle_type);
+  if (s.fill_type != settings.fill_type)
+    setFillSettings(s.fill_random, s.fill_color, s.fill_type);
+  settings.fill_random = s.fill_random;
+  settings.fill_color = s.fill_color;
+  setGradientSettings(s.start_color, s.end_color, s.gradient_steps);
+  if (s.main_color != settings.main_color) setMainColor(s.main_color);
+  if (s.circle_steps != settings.circle_steps) setCircleSteps(s.circle_steps);
+  setShift(s.shift_x, s.shift_y);
+  setRotate(s.rotate_angle, s.rotate_inplace);
+  setRotationType(s.rotation_type);
+  setScale(s.scale_x, s.scale_y, s.scale_inplace);
+  setShear(s.shear_x, s.shear_y, s.shear_inplace);
+  if (s.interpolation_type != settings.interpolation_type)
+    setInterpolationType(s.interpolation_type);
+  if (s.transform_tile_size != settings.transform_tile_size ||
+      s.transform_prefetch != settings.transform_prefetch)
+    setTransformTiling(s.transform_tile_size, s.transform_prefetch);
+  if (s.transform_cache_size != settings.transform_cache_size)
+    setTransformCache(s.transform_cache_size);
+}
+
+// prints time the render thread spent on commands submitted by `commands`
+void Canvas::timeCommands(QString name, std::function<void()> commands) {
+  std::shared_ptr<QElapsedTimer> timer(new QElapsedTimer());
+  render_thread.submit([timer](Drawer&) { timer->start(); });
+
+  commands();
+
+  render_thread.submit([timer, name](Drawer&) {
+    qDebug() << name << "run time:"
+             << QString().setNum(timer->elapsed() / 1000.0, 'f', 10);
+  });
 }
 
 void Canvas::keyPressEvent(QKeyEvent* e) {
@@ -294,53 +804,39 @@ void Canvas::keyPressEvent(QKeyEvent* e) {
     case 'X':
       qDebug() << settings;
       break;
+    case 'F':
+      qDebug() << "Repaints:" << repaint->statistics();
+      repaint->resetCounters();
+      break;
     case Qt::Key_Space:
       applySetupDraw();
       break;
 
     // tests
     case Qt::Key_1: {
-      clock_t st = clock();
-
-      example1();
-
-      clock_t fi = clock();
-      qDebug() << "example1 run time:"
-               << QString().setNum((fi - st) * 1.0 / CLOCKS_PER_SEC, 'f', 10);
-      redraw();
+      timeCommands("example1", [this]() { example1(); });
     } break;
 
     case Qt::Key_2: {
-      clock_t st = clock();
-
-      example2();
-
-      clock_t fi = clock();
-      qDebug() << "example2 run time:"
-               << QString().setNum((fi - st) * 1.0 / CLOCKS_PER_SEC, 'f', 10);
-      redraw();
+      timeCommands("example2", [this]() { example2(); });
     } break;
 
     case Qt::Key_3: {
-      clock_t st = clock();
-
-      example3();
-
-      clock_t fi = clock();
-      qDebug() << "example3 run time:"
-               << QString().setNum((fi - st) * 1.0 / CLOCKS_PER_SEC, 'f', 10);
-      redraw();
+      timeCommands("example3", [this]() { example3(); });
     } break;
 
     case Qt::Key_4: {
-      clock_t st = clock();
+      timeCommands("example4", [this]() { example4(); });
+    } break;
 
-      example4();
+    // benchmarks, they work on their own images and leave canvas untouched;
+    // they run on the render thread, after commands queued before
+    case Qt::Key_5: {
+      benchmark1();
+    } break;
 
-      clock_t fi = clock();
-      qDebug() << "example4 run time:"
-               << QString().setNum((fi - st) * 1.0 / CLOCKS_PER_SEC, 'f', 10);
-      redraw();
+    case Qt::Key_6: {
+      benchmark2();
     } break;
   }
 }
@@ -348,107 +844,345 @@ void Canvas::keyPressEvent(QKeyEvent* e) {
 /*  ------------------------------------------------------------------------  */
 /*  EXAMPLE TESTS  */
 
+// examples interleave drawing commands with canvas setters, which submit
+// commands of their own, so everything runs in the written order
 void Canvas::example1() {
   QColor bg(130, 51, 214);
-  image.fill(bg.rgba());
+  clear(bg);
 
-  drawer.drawBresenhamLine(QPoint(10, 15), QPoint(580, 440));
+  render_thread.submit([](Drawer& drawer) {
+    drawer.drawBresenhamLine(QPoint(10, 15), QPoint(580, 440));
+  });
   setLineType(LineType::antialiased);
-  drawer.drawApproximatedCircle(QPoint(240, 670), QPoint(456, 789), 35);
+  render_thread.submit([](Drawer& drawer) {
+    drawer.drawApproximatedCircle(QPoint(240, 670), QPoint(456, 789), 35);
+  });
   setMainColor(QColor(243, 1, 203));
-  QVector<QPoint> vec(
-      {QPoint(45, 67), QPoint(873, 145), QPoint(652, 147), QPoint(2, 356)});
-  drawer.drawPolygon(vec);
+  render_thread.submit([](Drawer& drawer) {
+    QVector<QPoint> vec(
+        {QPoint(45, 67), QPoint(873, 145), QPoint(652, 147), QPoint(2, 356)});
+    drawer.drawPolygon(vec);
 
-  drawer.drawBezierCurve(QPoint(479, 451), QPoint(488, 687), QPoint(692, 362),
-                         QPoint(725, 604));
+    drawer.drawBezierCurve(QPoint(479, 451), QPoint(488, 687),
+                           QPoint(692, 362), QPoint(725, 604));
+  });
 
-  vec = QVector<QPoint>({QPoint(386, 543), QPoint(314, 494), QPoint(147, 484),
-                         QPoint(119, 546), QPoint(223, 577), QPoint(306, 599),
-                         QPoint(322, 676), QPoint(293, 748), QPoint(140, 736),
-                         QPoint(144, 659)});
   setMainColor(QColor(1, 203, 203));
-  drawer.drawBasisSpline(vec);
+  render_thread.submit([](Drawer& drawer) {
+    QVector<QPoint> vec(
+        {QPoint(386, 543), QPoint(314, 494), QPoint(147, 484),
+         QPoint(119, 546), QPoint(223, 577), QPoint(306, 599),
+         QPoint(322, 676), QPoint(293, 748), QPoint(140, 736),
+         QPoint(144, 659)});
+    drawer.drawBasisSpline(vec);
+  });
 }
 
 void Canvas::example2() {
   QColor bg(255, 155, 116, 153);
-  image.fill(bg.rgba());
+  clear(bg);
 
   QColor fg(82, 15, 217, 89);
   setMainColor(fg);
 
   setLineType(LineType::antialiased);
-  drawer.drawLine(QPoint(0, 0), QPoint(800, 800));
-  drawer.drawLine(QPoint(800, 0), QPoint(0, 800));
-  drawer.drawLine(QPoint(100, 100), QPoint(100, 700));
-  drawer.drawApproximatedCircle(QPoint(400, 400), 300, 16);
+  render_thread.submit([](Drawer& drawer) {
+    drawer.drawLine(QPoint(0, 0), QPoint(800, 800));
+    drawer.drawLine(QPoint(800, 0), QPoint(0, 800));
+    drawer.drawLine(QPoint(100, 100), QPoint(100, 700));
+    drawer.drawApproximatedCircle(QPoint(400, 400), 300, 16);
+  });
 
   setFillSettings(
       true,
       QColor(rand() % 255, rand() % 255, rand() % 255, rand() % 255).rgba(),
       FillType::stack);
-  drawer.fill(QPoint(110, 125), settings.fill_color.rgba());
+  QRgb color = settings.fill_color.rgba();
+  render_thread.submit(
+      [color](Drawer& drawer) { drawer.fill(QPoint(110, 125), color); });
   setFillSettings(
       true,
       QColor(rand() % 255, rand() % 255, rand() % 255, rand() % 255).rgba(),
       FillType::stack);
-  drawer.fill(QPoint(105, 550), settings.fill_color.rgba());
-
-  drawer.drawPoint(331, 526);
-  drawer.drawPoint(332, 527);
-  drawer.drawPoint(332, 525);
-  drawer.drawPoint(330, 525);
-  drawer.drawPoint(330, 527);
-
-  drawer.drawPoint(337, 605);
-  drawer.drawPoint(338, 606);
-  drawer.drawPoint(338, 604);
-  drawer.drawPoint(336, 604);
-  drawer.drawPoint(336, 606);
-
-  drawer.drawPoint(427, 521);
-  drawer.drawPoint(428, 522);
-  drawer.drawPoint(428, 520);
-  drawer.drawPoint(426, 520);
-  drawer.drawPoint(426, 522);
-
-  drawer.drawPoint(438, 641);
-  drawer.drawPoint(437, 640);
-  drawer.drawPoint(437, 642);
-  drawer.drawPoint(439, 642);
-  drawer.drawPoint(439, 640);
+  color = settings.fill_color.rgba();
+  render_thread.submit([color](Drawer& drawer) {
+    drawer.fill(QPoint(105, 550), color);
+
+    drawer.drawPoint(331, 526);
+    drawer.drawPoint(332, 527);
+    drawer.drawPoint(332, 525);
+    drawer.drawPoint(330, 525);
+    drawer.drawPoint(330, 527);
+
+    drawer.drawPoint(337, 605);
+    drawer.drawPoint(338, 606);
+    drawer.drawPoint(338, 604);
+    drawer.drawPoint(336, 604);
+    drawer.drawPoint(336, 606);
+
+    drawer.drawPoint(427, 521);
+    drawer.drawPoint(428, 522);
+    drawer.drawPoint(428, 520);
+    drawer.drawPoint(426, 520);
+    drawer.drawPoint(426, 522);
+
+    drawer.drawPoint(438, 641);
+    drawer.drawPoint(437, 640);
+    drawer.drawPoint(437, 642);
+    drawer.drawPoint(439, 642);
+    drawer.drawPoint(439, 640);
+  });
 
   setFillSettings(false, QColor(255, 255, 255, 255).rgba(), FillType::scanline);
-  drawer.fill(QPoint(200, 15), settings.fill_color.rgba());
+  color = settings.fill_color.rgba();
+  render_thread.submit(
+      [color](Drawer& drawer) { drawer.fill(QPoint(200, 15), color); });
   setDebug(true);
   setFillSettings(false, QColor(33, 0, 0, 255).rgba(), FillType::scanline);
-  drawer.fill(QPoint(400, 541), settings.fill_color.rgba());
+  color = settings.fill_color.rgba();
+  render_thread.submit(
+      [color](Drawer& drawer) { drawer.fill(QPoint(400, 541), color); });
   setDebug(false);
 }
 
 void Canvas::example3() {
   setGradientSettings(QColor(76, 224, 162), QColor(218, 255, 56), 8);
-  drawer.paintVerticalGradient(settings.start_color, settings.end_color,
-                               settings.gradient_steps);
+  const Settings current = settings;
+  render_thread.submit([current](Drawer& drawer) {
+    drawer.paintVerticalGradient(current.start_color, current.end_color,
+                                 current.gradient_steps);
+  });
 
   setMainColor(QColor(0, 0, 0, 255));
-  QVector<QPoint> vec({QPoint(198, 162), QPoint(197, 278), QPoint(329, 158),
-                       QPoint(350, 393), QPoint(173, 392), QPoint(393, 242),
-                       QPoint(438, 443), QPoint(348, 544), QPoint(181, 552)});
-  drawer.drawBasisSpline(vec);
+  render_thread.submit([](Drawer& drawer) {
+    QVector<QPoint> vec({QPoint(198, 162), QPoint(197, 278), QPoint(329, 158),
+                         QPoint(350, 393), QPoint(173, 392), QPoint(393, 242),
+                         QPoint(438, 443), QPoint(348, 544),
+                         QPoint(181, 552)});
+    drawer.drawBasisSpline(vec);
 
-  drawer.transform(drawer.createRotateMatrix(30, true));
-  drawer.transform(drawer.createShiftMatrix(-25, 25));
+    drawer.transform(drawer.createRotateMatrix(30, true));
+    drawer.transform(drawer.createShiftMatrix(-25, 25));
+  });
 }
 
+// every rotation is a separate command, so each of them is shown as a frame
 void Canvas::example4() {
-  drawer.transform(drawer.createShiftMatrix(15, 15));
-  drawer.transform(drawer.createShiftMatrix(-15, -15));
+  render_thread.submit([](Drawer& drawer) {
+    drawer.transform(drawer.createShiftMatrix(15, 15));
+    drawer.transform(drawer.createShiftMatrix(-15, -15));
+  });
   for (int i = 0; i < 360 / 30; ++i) {
-    drawer.transform(drawer.createRotateMatrix(30, true));
-    DebugWindow::waitFor(40);
-    redraw();
+    render_thread.submit([](Drawer& drawer) {
+      drawer.transform(drawer.createRotateMatrix(30, true));
+      QThread::msleep(40);
+    });
+  }
+  render_thread.submit([](Drawer& drawer) {
+    drawer.transform(drawer.createScaleMatrix(1.2, 1.2, true));
+  });
+}
+
+
+/*  ------------------------------------------------------------------------  */
+/*  BENCHMARKS  */
+
+// rotation of an 8K image with row order and tiled traversal; run under
+// `perf stat -e cache-misses` to see the difference in cache misses
+void Canvas::benchmark1() {
+  // commands of the runs share the image and its drawer, the render thread
+  // runs them in order and its own drawer is left alone
+  std::shared_ptr<QImage> big(
+      new QImage(Drawer::createAlignedImage(7680, 4320)));
+  std::shared_ptr<Drawer> bench(
+      new Drawer(big.get(), settings.main_color.rgba()));
+  bench->initialize(settings.line_type, settings.circle_type,
+                    settings.circle_steps, settings.fill_type,
+                    settings.interpolation_type);
+  const QRgb start_color = settings.start_color.rgba();
+  const QRgb end_color = settings.end_color.rgba();
+
+  const QTransform rotation = bench->createRotateMatrix(30, true);
+  const struct {
+    int tile_size;
+    bool prefetch;
+  } runs[] = {{0, false}, {64, false}, {64, true}};
+
+  for (const auto& run : runs) {
+    // every run rotates the same, freshly painted picture
+    const int tile_size = run.tile_size;
+    const bool prefetch = run.prefetch;
+    render_thread.submit([big, bench, start_color, end_color, tile_size,
+                          prefetch](Drawer&) {
+      bench->setTransformTiling(tile_size, prefetch);
+      bench->paintHorizontalGradient(start_color, end_color, 255);
+    });
+
+    timeCommands(QString("benchmark1 rotation 8K, tile %1, prefetch %2")
+                     .arg(tile_size)
+                     .arg(prefetch),
+                 [this, big, bench, rotation]() {
+                   render_thread.submit([big, bench, rotation](Drawer&) {
+                     bench->transform(rotation);
+                   });
+                 });
+  }
+}
+
+// rotation of an 8K image with 2D resampling and with three 1D shear passes
+void Canvas::benchmark2() {
+  std::shared_ptr<QImage> big(
+      new QImage(Drawer::createAlignedImage(7680, 4320)));
+  std::shared_ptr<Drawer> bench(
+      new Drawer(big.get(), settings.main_color.rgba()));
+  bench->initialize(settings.line_type, settings.circle_type,
+                    settings.circle_steps, settings.fill_type,
+                    settings.interpolation_type);
+  const QRgb start_color = settings.start_color.rgba();
+  const QRgb end_color = settings.end_color.rgba();
+  auto repaint_picture = [big, bench, start_color, end_color](Drawer&) {
+    bench->paintHorizontalGradient(start_color, end_color, 255);
+  };
+
+  render_thread.submit(repaint_picture);
+  timeCommands("benchmark2 rotation 8K, matrix", [this, big, bench]() {
+    render_thread.submit([big, bench](Drawer&) {
+      bench->transform(bench->createRotateMatrix(30, true));
+    });
+  });
+
+  render_thread.submit(repaint_picture);
+  timeCommands("benchmark2 rotation 8K, shears", [this, big, bench]() {
+    render_thread.submit(
+        [big, bench](Drawer&) { bench->rotateThreeShear(30, true); });
+  });
+}
+
+// times are taken on the render thread: run time from the first to the last
+// command of an event, latency from replaying the event to the end of its
+// last command, so it includes waiting for commands of earlier events
+bool Canvas::replayJournal(QString file_name, bool paced) {
+  QVector<JournalEvent> events;
+  if (!Journal::read(file_name, &events)) return false;
+
+  struct Sample {
+    QString name;
+    qint64 run;  // in microseconds
+    qint64 latency;
+  };
+  // replayed events would otherwise be recorded into a running journal
+  journal.suspend(true);
+  std::shared_ptr<QVector<Sample>> samples(new QVector<Sample>());
+  std::shared_ptr<QElapsedTimer> clock(new QElapsedTimer());
+  clock->start();
+
+  for (const JournalEvent& event : events) {
+    const qint64 wait = event.time - clock->elapsed();
+    if (paced && wait > 0) {
+      QEventLoop loop;
+      QTimer::singleShot(wait, &loop, &QEventLoop::quit);
+      loop.exec();
+    }
+
+    const QString name = Journal::name(event, settings.mode);
+    const qint64 replayed = clock->nsecsElapsed() / 1000;
+    std::shared_ptr<qint64> started(new qint64(0));
+    render_thread.submit([clock, started](Drawer&) {
+      *started = clock->nsecsElapsed() / 1000;
+    });
+    replayEvent(event);
+    render_thread.submit([clock, started, samples, name, replayed](Drawer&) {
+      const qint64 finished = clock->nsecsElapsed() / 1000;
+      samples->push_back({name, finished - *started, finished - replayed});
+    });
+
+    // frames are taken as they come, so they do not pile up
+    QCoreApplication::processEvents();
+  }
+
+  std::shared_ptr<std::atomic<bool>> done(new std::atomic<bool>(false));
+  render_thread.submit([done](Drawer&) { *done = true; });
+  while (!*done) QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+  journal.suspend(false);
+
+  QMap<QString, QVector<qint64>> runs;
+  QMap<QString, QVector<qint64>> latencies;
+  for (const Sample& sample : *samples) {
+    runs[sample.name].push_back(sample.run);
+    latencies[sample.name].push_back(sample.latency);
+  }
+
+  auto percentiles = [](QVector<qint64> times) {
+    std::sort(times.begin(), times.end());
+    QStringList values;
+    for (int p : {50, 90, 99})
+      values << QString::number(times[qMin(times.size() - 1,
+                                           times.size() * p / 100)]);
+    values << QString::number(times.last());
+    return values.join(" / ");
+  };
+
+  qDebug().nospace() << "Replayed " << events.size() << " events in "
+                     << clock->elapsed() << " ms"
+                     << (paced ? " with original pacing" : "")
+                     << ", times p50 / p90 / p99 / max in us:";
+  for (const QString& name : runs.keys()) {
+    qDebug().nospace().noquote()
+        << name << " x" << runs[name].size() << ": run "
+        << percentiles(runs[name]) << ", latency "
+        << percentiles(latencies[name]);
+  }
+
+  return true;
+}
+
+void Canvas::replayEvent(const JournalEvent& event) {
+  switch (event.type) {
+    case JournalEventType::settings:
+      applySettings(event.settings);
+      break;
+
+    case JournalEventType::press:
+      processMousePress(event.points[0].x(), event.points[0].y());
+      break;
+
+    case JournalEventType::operation:
+      applyOperation(event.operation);
+      break;
+
+    case JournalEventType::setup_draw:
+      applySetupDraw();
+      break;
+
+    case JournalEventType::stroke: {
+      const QVector<QPoint> polyline = event.points;
+      render_thread.submit(
+          [polyline](Drawer& drawer) { drawer.drawPolyline(polyline); },
+          QString(), true);
+    } break;
+
+    case JournalEventType::load:
+      loadFile(event.file_name, event.clip);
+      break;
+
+    case JournalEventType::clear:
+      clear(event.color);
+      break;
+
+    case JournalEventType::resize:
+      setCanvasSize(event.size.width(), event.size.height());
+      break;
+
+    case JournalEventType::tiled:
+      setTiled(event.tiled);
+      break;
+
+    case JournalEventType::undo:
+      undo();
+      break;
+
+    case JournalEventType::redo:
+      redo();
+      break;
   }
-  drawer.transform(drawer.createScaleMatrix(1.2, 1.2, true));
 }
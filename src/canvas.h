@@ -2,15 +2,23 @@
 #define CANVAS_H
 
 #include <QtWidgets>
+#include <functional>
+#include "autosave.h"
+#include "debugwindow.h"
 #include "drawer.h"
+#include "journal.h"
+#include "mippyramid.h"
+#include "renderthread.h"
+#include "repaintscheduler.h"
 #include "settings.h"
+#include "tiledimage.h"
 
 class Canvas : public QWidget {
   Q_OBJECT
  public:
   explicit Canvas(QWidget* parent = 0);
 
-  void loadFile(QString file_name);
+  void loadFile(QString file_name, QRect clip = QRect());
   void saveFile(QString file_name);
   void setDefaultMode();
   void setMode(Mode _mode);
@@ -18,6 +26,8 @@ class Canvas : public QWidget {
   void applySetupDraw();
   void setDebug(bool _debug);
   void switchGrid();
+  void setTiled(bool _tiled);
+  void setCanvasSize(int _width, int _height);
   void setZoom(qreal _scale);
   void setLineType(LineType _line_type);
   void setCircleType(CircleType _circle_type);
@@ -30,9 +40,19 @@ class Canvas : public QWidget {
   void setDebugColor(QColor _debug_color);
   void setShift(int _shift_x, int _shift_y);
   void setRotate(qreal _rotation_angle, bool _rotate_inplace);
+  void setRotationType(RotationType _rotation_type);
   void setScale(qreal _scale_x, qreal _scale_y, bool _scale_inplace);
   void setShear(qreal _shear_x, qreal _shear_y, bool _shear_inplace);
   void setInterpolationType(InterpolationType _type);
+  void setTransformTiling(int _tile_size, bool _prefetch);
+  void setTransformCache(int _megabytes);
+  void setProgressThreshold(int _milliseconds);
+  void setFrameRate(int _frame_rate);
+  void setUndoHistory(int _megabytes, bool _compress);
+  void setAutosaveInterval(int _seconds);
+  void setSaveQuality(int _quality);
+  void undo();
+  void redo();
   void clear(QColor color = Qt::GlobalColor::white);
 
   /* TESTS */
@@ -41,28 +61,83 @@ class Canvas : public QWidget {
   void example3();
   void example4();
 
+  /* BENCHMARKS */
+  void benchmark1();
+  void benchmark2();
+  // replays a journal on this canvas, printing percentiles of times of its
+  // events; `paced` keeps the original times between events
+  bool replayJournal(QString file_name, bool paced);
+
+  /* AUTOSAVE */
+  // returns true when the previous session left a picture to recover
+  bool startAutosave();
+  void recover();
+  void discardRecovery();
+
+  /* JOURNAL */
+  bool startJournal(QString file_name);
+  void stopJournal();
+  bool isRecordingJournal() const;
+
   Settings settings;  // public, use as read only
 
  signals:
   void changedToDefaultMode();
   void changedSetupMode(bool setup);
+  // saving runs in the background, these come from other threads
+  void saveStarted(QString file_name);
+  void saveFinished(QString file_name, bool successful);
 
  protected:
   // overloaded methods of QWidget
   virtual void keyPressEvent(QKeyEvent* e) override;
-  virtual void paintEvent(QPaintEvent*) override;
+  virtual void paintEvent(QPaintEvent* e) override;
   virtual void mousePressEvent(QMouseEvent* e) override;
   virtual void mouseMoveEvent(QMouseEvent* e) override;
+  virtual void mouseReleaseEvent(QMouseEvent* e) override;
 
  private:
+  // copies of pixels owned by the render thread, as of the last frame; one of
+  // them is null
   QImage image;
-  //  QImage image_scaled;
+  TiledImage tiles;
+  QImage image_scaled;   // image at current zoom, as displayed
+  QImage preview;        // of a picture being loaded, stretched when shown
+  QRegion scaled_dirty;  // parts of image_scaled to be rescaled
+  MipPyramid mipmaps;
 
-  Drawer drawer;
+  RenderThread render_thread;
+  QProgressDialog* progress;
+  RepaintScheduler* repaint;  // paces repaints to settings.frame_rate
   QVector<QPoint> points;
+  // points of a freehand stroke not drawn yet, after the last drawn one
+  QVector<QPoint> stroke_points;
+  QTimer stroke_timer;
+  Journal journal;
+  Autosave* autosave = nullptr;
+  QTimer autosave_timer;
+  QString recovery_file;
+  QSize autosave_size;     // of the picture autosave knows about
+  QRegion autosave_dirty;  // changed since the current checkpoint started
+  // spans of tiles of the current checkpoint, in tile coordinates, and the
+  // next tile of the last one; tiles already copied are marked
+  QVector<QRect> autosave_spans;
+  QPoint autosave_next;
+  QBitArray autosave_taken;
+
+  void createProgressDialog();
+  void timeCommands(QString name, std::function<void()> commands);
 
   void processMousePress(int mouse_x, int mouse_y);
+  void applySettings(const Settings& _settings);
+  void replayEvent(const JournalEvent& event);
+  void flushStroke();
+  void autosaveStep();
   void redraw();
+  void invalidate(QRect rect);
+  QRect canvasRect() const;
+  void updateScaledImage();
+  void drawGrid(QPainter& painter, QRect exposed);
 };
 
 #endif  // CANVAS_H
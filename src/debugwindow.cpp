@@ -1,22 +1,95 @@
 #include "debugwindow.h"
+#include <cstring>
 
-DebugWindow::DebugWindow(QImage* _image, QWidget* parent) : QWidget(parent) {
+TraceView::TraceView(const QImage* _image, QWidget* parent) : QWidget(parent) {
   image = _image;
-  this->setFixedSize(image->width(), image->height());
-  this->show();
+  setFixedSize(image->size());
 }
 
-void DebugWindow::paintEvent(QPaintEvent*) {
+void TraceView::paintEvent(QPaintEvent* e) {
   QPainter painter(this);
-  painter.drawImage(0, 0, *image);
+  painter.drawImage(e->rect().topLeft(), *image, e->rect());
 }
 
-void DebugWindow::redraw() { update(); }
+DebugWindow::DebugWindow(const StepTrace& _trace, int rate, QWidget* parent)
+    : QWidget(parent), trace(_trace) {
+  setAttribute(Qt::WA_DeleteOnClose);
+  setWindowTitle(tr("Debug replay"));
+  frame = trace.before().copy();
 
-void DebugWindow::waitFor(int milliseconds) {
-  QTime dieTime = QTime::currentTime().addMSecs(milliseconds);
-  while (QTime::currentTime() < dieTime) {
-    QCoreApplication::processEvents(QEventLoop::AllEvents,
-                                    (milliseconds < 100) ? milliseconds : 100);
+  QVBoxLayout* layout = new QVBoxLayout(this);
+  QScrollArea* scroll = new QScrollArea(this);
+  view = new TraceView(&frame);
+  repaint = new RepaintScheduler(view, rate);
+  scroll->setWidget(view);
+  layout->addWidget(scroll);
+
+  QHBoxLayout* controls = new QHBoxLayout();
+  play = new QPushButton(tr("Pause"), this);
+  slider = new QSlider(Qt::Horizontal, this);
+  slider->setRange(0, trace.stepCount());
+  speed = new QSpinBox(this);
+  speed->setRange(1, qMax(1, trace.stepCount()));
+  speed->setValue(qMax(1, trace.stepCount() / (10 * rate)));  // 10 seconds
+  speed->setSuffix(tr(" steps/frame"));
+  label = new QLabel(this);
+  controls->addWidget(play);
+  controls->addWidget(slider);
+  controls->addWidget(speed);
+  controls->addWidget(label);
+  layout->addLayout(controls);
+
+  connect(play, &QPushButton::clicked, this, [this]() {
+    if (timer.isActive()) {
+      timer.stop();
+    } else {
+      if (shown == trace.stepCount()) seek(0);
+      timer.start();
+    }
+    play->setText(timer.isActive() ? tr("Pause") : tr("Play"));
+  });
+  connect(slider, &QSlider::sliderMoved, this, &DebugWindow::seek);
+  connect(&timer, &QTimer::timeout, this, &DebugWindow::advance);
+
+  updateLabel();
+  timer.start(repaint->interval());
+  resize(qMin(frame.width() + 40, 1200), qMin(frame.height() + 80, 900));
+  show();
+}
+
+void DebugWindow::advance() {
+  seek(qMin(shown + speed->value(), trace.stepCount()));
+  if (shown == trace.stepCount()) {
+    timer.stop();
+    play->setText(tr("Play"));
   }
 }
+
+// going back starts over from the image before the first step
+void DebugWindow::seek(int n) {
+  if (n < shown) {
+    frame = trace.before().copy();
+    shown = 0;
+    repaint->requestAll();
+  }
+
+  // spans are repainted together, as one rectangle covering them
+  const QImage& after = trace.after();
+  QRect changed;
+  for (; shown < n; ++shown) {
+    for (const QRect& span : trace.step(shown)) {
+      memcpy(frame.scanLine(span.y()) + span.x() * sizeof(QRgb),
+             after.constScanLine(span.y()) + span.x() * sizeof(QRgb),
+             span.width() * sizeof(QRgb));
+      changed |= span;
+    }
+  }
+  repaint->request(changed);
+
+  slider->setValue(shown);
+  updateLabel();
+}
+
+void DebugWindow::updateLabel() {
+  label->setText(tr("%1 / %2").arg(shown).arg(trace.stepCount()));
+}
@@ -2,19 +2,46 @@
 #define DEBUGWINDOW_H
 
 #include <QtWidgets>
+#include "repaintscheduler.h"
+#include "steptrace.h"
 
+// shows an image, only repainting parts it is told about
+class TraceView : public QWidget {
+ public:
+  TraceView(const QImage* _image, QWidget* parent = 0);
+
+ protected:
+  virtual void paintEvent(QPaintEvent* e) override;
+
+ private:
+  const QImage* image;
+};
+
+// Replays a recorded trace of an algorithm, starting from the image before
+// it and revealing pixels changed by each step. Playback runs on a timer at
+// a chosen number of steps per frame, at most `rate` frames per second; the
+// slider jumps to any step.
 class DebugWindow : public QWidget {
   Q_OBJECT
 
+ public:
+  DebugWindow(const StepTrace& _trace, int rate = 60, QWidget* parent = 0);
+
  private:
-  QImage* image;
+  StepTrace trace;
+  QImage frame;  // image after `shown` steps
+  int shown = 0;
 
- protected:
-  virtual void paintEvent(QPaintEvent*);
+  TraceView* view;
+  RepaintScheduler* repaint;
+  QSlider* slider;
+  QSpinBox* speed;
+  QPushButton* play;
+  QLabel* label;
+  QTimer timer;
 
- public:
-  DebugWindow(QImage* _image, QWidget* parent = 0);
-  static void waitFor(int milliseconds);
-  void redraw();
+  void advance();
+  void seek(int n);
+  void updateLabel();
 };
 #endif  // DEBUGWINDOW_H
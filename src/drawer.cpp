@@ -1,10 +1,13 @@
 #include "drawer.h"
+#include <cstring>
+#include <limits>
 // TODO get rid of in range checks
 
-Drawer::Drawer() {}
+Drawer::Drawer() { resetDirtyRegion(); }
 Drawer::Drawer(QImage* _image, QRgb _main_color) {
   setImage(_image);
   setMainColor(_main_color);
+  resetDirtyRegion();
 }
 
 void Drawer::initialize(LineType _line_type, CircleType _circle_type,
@@ -17,13 +20,135 @@ void Drawer::initialize(LineType _line_type, CircleType _circle_type,
   setInterpolationType(_interpolation_type);
 }
 
-void Drawer::setImage(QImage* _image) {
+void Drawer::setImage(QImage* _image, bool _fixed_buffer) {
   image = _image;
+  tiles = nullptr;
+  fixed_buffer = _fixed_buffer;
+
+  // drawing writes ARGB32 pixels directly, other formats are converted once
+  if (!image->isNull() && image->format() != QImage::Format_ARGB32) {
+    qWarning() << "Converting image to ARGB32, format was"
+               << int(image->format());
+    *image = toWorkingFormat(*image);
+  }
+
   width = image->width();
   height = image->height();
+  stride = image->bytesPerLine() / sizeof(QRgb);
   bits = (QRgb*)image->bits();
 }
 
+// only ARGB32: drawing writes colours with alpha, which RGB32 buffers must
+// not get, and other formats would need converting. Mipmaps and history
+// belong to the previous image, so they are detached
+bool Drawer::setBuffer(uchar* _data, int _width, int _height,
+                       int _bytes_per_line, QImage::Format _format) {
+  if (_format != QImage::Format_ARGB32) {
+    qWarning() << "Cannot draw on a buffer of format" << int(_format)
+               << "without converting it";
+    return false;
+  }
+  if (_data == nullptr || _width <= 0 || _height <= 0 ||
+      _bytes_per_line < _width * int(sizeof(QRgb)) ||
+      _bytes_per_line % sizeof(QRgb) != 0 ||
+      quintptr(_data) % sizeof(QRgb) != 0) {
+    qWarning() << "Invalid buffer" << _width << "x" << _height << "with"
+               << _bytes_per_line << "bytes per line";
+    return false;
+  }
+
+  mipmaps = nullptr;
+  history = nullptr;
+  buffer_view = QImage(_data, _width, _height, _bytes_per_line,
+                       QImage::Format_ARGB32);
+  setImage(&buffer_view, true);
+
+  return true;
+}
+
+// drawing and filling work on tiles, transformations are not supported
+void Drawer::setTiledImage(TiledImage* _tiles) {
+  tiles = _tiles;
+  image = nullptr;
+  width = tiles->width();
+  height = tiles->height();
+  stride = width;
+  bits = nullptr;
+}
+
+static void freeAligned(void* data) { qFreeAligned(data); }
+
+// pixels are uninitialised; image frees its memory once no copy uses it
+static QImage allocateImage(int _width, int _height, int bytes_per_line) {
+  if (_width <= 0 || _height <= 0) return QImage();
+
+  uchar* data = (uchar*)qMallocAligned(size_t(bytes_per_line) * _height,
+                                       Drawer::ROW_ALIGNMENT);
+  if (data == nullptr) {
+    qWarning() << "Cannot allocate image" << _width << "x" << _height;
+    return QImage();
+  }
+
+  return QImage(data, _width, _height, bytes_per_line, QImage::Format_ARGB32,
+                freeAligned, data);
+}
+
+// every row starts on a 64 byte boundary, so vectorised loops over a row can
+// use aligned loads
+QImage Drawer::createAlignedImage(int _width, int _height) {
+  const int bytes_per_line =
+      (_width * int(sizeof(QRgb)) + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT *
+      ROW_ALIGNMENT;
+
+  return allocateImage(_width, _height, bytes_per_line);
+}
+
+bool Drawer::isWorkingFormat(const QImage& _image) {
+  return !_image.isNull() && _image.format() == QImage::Format_ARGB32 &&
+         _image.bytesPerLine() % ROW_ALIGNMENT == 0 &&
+         quintptr(_image.constBits()) % ROW_ALIGNMENT == 0;
+}
+
+// aligned ARGB32 copy of an image in any format; other formats are converted
+// by painting, row by row, so there is no second full size copy
+QImage Drawer::toWorkingFormat(const QImage& _image) {
+  QImage result = createAlignedImage(_image.width(), _image.height());
+  if (result.isNull()) return result;
+
+  if (_image.format() == QImage::Format_ARGB32) {
+    const int row_bytes = _image.width() * sizeof(QRgb);
+    for (int y = 0; y < _image.height(); ++y)
+      memcpy(result.scanLine(y), _image.constScanLine(y), row_bytes);
+  } else {
+    QPainter painter(&result);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(0, 0, _image);
+  }
+
+  return result;
+}
+
+void Drawer::allocateBackBuffer() {
+  if (back_buffer.size() != image->size() ||
+      back_buffer.format() != QImage::Format_ARGB32 ||
+      back_buffer.bytesPerLine() != image->bytesPerLine())
+    back_buffer = allocateImage(width, height, image->bytesPerLine());
+}
+
+// result rendered to the back buffer becomes the image; previous pixels
+// become the back buffer for the next transformation
+void Drawer::presentBackBuffer() {
+  if (fixed_buffer) {
+    // row by row, padding after the last row may not belong to the buffer
+    for (int y = 0; y < height; ++y)
+      memcpy(bits + size_t(y) * stride, back_buffer.constScanLine(y),
+             width * sizeof(QRgb));
+  } else {
+    image->swap(back_buffer);
+    bits = (QRgb*)image->bits();
+  }
+}
+
 void Drawer::setMainColor(QRgb _main_color) { main_color = _main_color; }
 
 void Drawer::setDebug(bool _debug, QRgb _debug_color) {
@@ -45,6 +170,99 @@ void Drawer::setInterpolationType(InterpolationType _interpolation_type) {
 
 void Drawer::setCircleSteps(int _circle_steps) { circle_steps = _circle_steps; }
 
+// union of everything changed since last reset
+QRegion Drawer::dirtyRegion() const {
+  QRegion region = dirty_region;
+  if (dirty_left <= dirty_right)
+    region += QRect(QPoint(dirty_left, dirty_top),
+                    QPoint(dirty_right, dirty_bottom));
+
+  return region;
+}
+
+void Drawer::resetDirtyRegion() {
+  dirty_region = QRegion();
+  dirty_left = dirty_top = std::numeric_limits<int>::max();
+  dirty_right = dirty_bottom = std::numeric_limits<int>::min();
+}
+
+// single pixels only grow a bounding rectangle, which is much cheaper than
+// adding them to a region
+inline void Drawer::markDirty(int x, int y) {
+  if (x < dirty_left) dirty_left = x;
+  if (x > dirty_right) dirty_right = x;
+  if (y < dirty_top) dirty_top = y;
+  if (y > dirty_bottom) dirty_bottom = y;
+}
+
+void Drawer::markDirty(QRect rect) { dirty_region += rect; }
+
+void Drawer::setHistory(UndoHistory* _history) { history = _history; }
+
+// operations writing whole areas save them at once, before the first write
+void Drawer::saveForUndo(QRect rect) {
+  if (history != nullptr) history->touch(rect);
+}
+
+void Drawer::setProgressCallback(std::function<bool(int, int)> _callback) {
+  progress_callback = _callback;
+}
+
+// false when the operation has been cancelled
+inline bool Drawer::reportProgress(int done, int total) {
+  return !progress_callback || progress_callback(done, total);
+}
+
+// in debug mode operations record what they change step by step instead of
+// showing it (and waiting) as they go; only plain images are traced
+StepTrace* Drawer::beginTrace() {
+  if (!debug || tiles != nullptr) return nullptr;
+
+  trace = StepTrace(image->copy());
+  return &trace;
+}
+
+void Drawer::endTrace(StepTrace* _trace) {
+  if (_trace == nullptr) return;
+
+  _trace->finish(image->copy());
+  traces.push_back(*_trace);
+  trace = StepTrace();
+}
+
+QVector<StepTrace> Drawer::takeTraces() {
+  QVector<StepTrace> taken;
+  taken.swap(traces);
+
+  return taken;
+}
+
+// coordinates have to be inside of the image
+inline QRgb Drawer::pixelAt(int x, int y) {
+  return tiles != nullptr ? tiles->pixel(x, y) : bits[y * stride + x];
+}
+
+inline void Drawer::setPixelAt(int x, int y, QRgb color) {
+  markDirty(x, y);
+  if (history != nullptr) history->touch(x, y);
+  if (tiles != nullptr)
+    tiles->setPixel(x, y, color);
+  else
+    bits[y * stride + x] = color;
+}
+
+void Drawer::setMipmaps(MipPyramid* _mipmaps) { mipmaps = _mipmaps; }
+
+void Drawer::setTransformTiling(int _tile_size, bool _prefetch) {
+  transform_tile_size = _tile_size;
+  transform_prefetch = _prefetch;
+}
+
+// cost of cached maps is counted in kilobytes
+void Drawer::setTransformCache(int _megabytes) {
+  transform_cache.setMaxCost(_megabytes * 1024);
+}
+
 
 /*  ------------------------------------------------------------------------  */
 /*  POINT METHODS  */
@@ -63,7 +281,7 @@ void Drawer::drawPoint(int x, int y, QRgb color) {
     //    image->setPixel(x, y, color);
 
     // faster
-    bits[y * width + x] = color;
+    setPixelAt(x, y, color);
   }
 }
 
@@ -71,7 +289,7 @@ void Drawer::drawPoint(int x, int y, QRgb color) {
 inline void Drawer::blendPoint(int x, int y, QRgb _over) {
   if (x < 0 || x >= width || y < 0 || y >= height) return;
 
-  QColor base = image->pixelColor(x, y);
+  QColor base = QColor::fromRgba(pixelAt(x, y));
   QColor over;
   over.setRgba(_over);
 
@@ -85,7 +303,7 @@ inline void Drawer::blendPoint(int x, int y, QRgb _over) {
   int alpha = 255 * (a + b);
 
   QRgb color = (alpha << 24) | (red << 16) | (green << 8) | (blue);
-  bits[y * width + x] = color;
+  setPixelAt(x, y, color);
 }
 
 
@@ -515,6 +733,13 @@ void Drawer::drawPolygon(QVector<QPoint>& points) {
   }
 }
 
+// open chain of lines, a single point is drawn as a dot
+void Drawer::drawPolyline(const QVector<QPoint>& points) {
+  if (points.size() == 1) drawPoint(points[0]);
+  for (int i = 0; i + 1 < points.size(); ++i)
+    drawLine(points[i], points[i + 1]);
+}
+
 
 /*  ------------------------------------------------------------------------  */
 /*  BEZIER CURVE  */
@@ -606,8 +831,13 @@ void Drawer::paintVerticalGradient(QRgb start_color, QRgb end_color,
 
 void Drawer::paintVerticalGradient(QColor start_color, QColor end_color,
                                    int steps) {
+  markDirty(QRect(0, 0, width, height));
+  saveForUndo(QRect(0, 0, width, height));
   if (steps == 0) {
-    image->fill(end_color);
+    if (tiles != nullptr)
+      tiles->fill(end_color.rgba());
+    else
+      image->fill(end_color);
     return;
   }
 
@@ -616,6 +846,13 @@ void Drawer::paintVerticalGradient(QColor start_color, QColor end_color,
 
   int y_diff = ceil(height * 1.0 / steps);
 
+  // whole bands at once, so that tiles inside of them stay uniform
+  if (tiles != nullptr) {
+    for (int i = 0; i < steps; ++i)
+      tiles->fillRect(QRect(0, i * y_diff, width, y_diff), colors[i]);
+    return;
+  }
+
   int current_y = 0;
   for (int i = 0; i < steps; ++i) {
     for (int j = 0; j < y_diff; ++j) {
@@ -639,8 +876,13 @@ void Drawer::paintHorizontalGradient(QRgb start_color, QRgb end_color,
 
 void Drawer::paintHorizontalGradient(QColor start_color, QColor end_color,
                                      int steps) {
+  markDirty(QRect(0, 0, width, height));
+  saveForUndo(QRect(0, 0, width, height));
   if (steps == 0) {
-    image->fill(end_color);
+    if (tiles != nullptr)
+      tiles->fill(end_color.rgba());
+    else
+      image->fill(end_color);
     return;
   }
 
@@ -649,6 +891,12 @@ void Drawer::paintHorizontalGradient(QColor start_color, QColor end_color,
 
   int x_diff = ceil(width * 1.0 / steps);
 
+  if (tiles != nullptr) {
+    for (int i = 0; i < steps; ++i)
+      tiles->fillRect(QRect(i * x_diff, 0, x_diff, height), colors[i]);
+    return;
+  }
+
   for (int y = 0; y < height; ++y) {
     QRgb* line = (QRgb*)image->scanLine(y);
     int current_x = 0;
@@ -694,7 +942,11 @@ void Drawer::getGradientColors(QRgb* colors, QColor start_color,
 /*  ------------------------------------------------------------------------  */
 /*  SCANLINE FLOOD FILLING ("Smith's")  */
 void Drawer::fill(QPoint start, QRgb target_color) {
-  QRgb prev_color = image->pixel(start);
+  if (start.x() < 0 || start.x() >= width || start.y() < 0 ||
+      start.y() >= height)
+    return;
+
+  QRgb prev_color = pixelAt(start.x(), start.y());
 
   switch (fill_type) {
     case FillType::scanline: {
@@ -718,16 +970,16 @@ void Drawer::fill(QPoint start, QRgb target_color) {
 void Drawer::fillScanline(QPoint start, QRgb target_color, QRgb prev_color) {
   if (prev_color == target_color) return;
 
-
-  DebugWindow* debug_window;
-  if (debug) {
-    debug_window = new DebugWindow(image);
-  }
+  StepTrace* step_trace = beginTrace();
 
   QStack<QPoint> stack;
   stack.push(start);
+  int spans = 0;
 
   while (!stack.isEmpty()) {
+    // number of spans is not known up front, height is a rough estimate
+    if ((++spans & 255) == 0 && !reportProgress(spans, height)) break;
+
     QPoint point = stack.pop();
     int x = point.x();
     int y = point.y();
@@ -735,43 +987,42 @@ void Drawer::fillScanline(QPoint start, QRgb target_color, QRgb prev_color) {
     bool span_above = false;
     bool span_below = false;
 
-    QRgb* line = (QRgb*)image->scanLine(y);
     // rewind to the left border
-    while (a >= 0 && line[a] == prev_color) --a;
+    while (a >= 0 && pixelAt(a, y) == prev_color) --a;
     ++a;
-
-    QRgb* line_above = (QRgb*)image->constScanLine(y + 1);
-    QRgb* line_below = (QRgb*)image->constScanLine(y - 1);
+    const int left = a;
 
     // go towards right border, mark potential down/up splits
-    while (a < image->width() && line[a] == prev_color) {
-      line[a] = target_color;
+    while (a < width && pixelAt(a, y) == prev_color) {
+      setPixelAt(a, y, target_color);
 
-      if (!span_above && y > 0 && line_below[a] == prev_color) {
+      if (!span_above && y > 0 && pixelAt(a, y - 1) == prev_color) {
         // found segment below to be filled
         stack.push(QPoint(a, y - 1));  // save where it starts
         span_above = true;             // ignore other points of this segment
-      } else if (span_above && y > 0 && line_below[a] != prev_color) {
+      } else if (span_above && y > 0 && pixelAt(a, y - 1) != prev_color) {
         // segment ended
         span_above = false;
 
         // similarly to if below, but for points above current line
-      } else if (!span_below && y < height - 1 && line_above[a] == prev_color) {
+      } else if (!span_below && y < height - 1 &&
+                 pixelAt(a, y + 1) == prev_color) {
         stack.push(QPoint(a, y + 1));
         span_below = true;
-      } else if (span_below && y < height - 1 && line_above[a] != prev_color) {
+      } else if (span_below && y < height - 1 &&
+                 pixelAt(a, y + 1) != prev_color) {
         span_below = false;
       }
       ++a;
     }
 
-    if (debug) {
-      debug_window->redraw();
-      DebugWindow::waitFor(10);
+    if (step_trace != nullptr && a > left) {
+      step_trace->beginStep();
+      step_trace->addSpan(y, left, a - 1);
     }
   }
 
-  if (debug) delete debug_window;
+  endTrace(step_trace);
 }
 
 
@@ -780,8 +1031,8 @@ void Drawer::fillScanline(QPoint start, QRgb target_color, QRgb prev_color) {
 // recursive implementation
 void Drawer::fillBorderRecursive(QPoint start, QRgb target_color,
                                  QRgb border_color) {
-  if (image->pixel(start) != border_color)
-    image->setPixelColor(start, target_color);
+  if (pixelAt(start.x(), start.y()) != border_color)
+    setPixelAt(start.x(), start.y(), target_color);
 
   fillBorderRecursive(start.x(), start.y(), target_color, border_color);
 }
@@ -806,8 +1057,7 @@ void Drawer::fillBorderRecursive(int x, int y, QRgb target_color,
 bool Drawer::_recursiveFloodFillTest(int x, int y, QRgb target_color,
                                      QRgb border_color) {
   if (x >= 0 && x < width && y >= 0 && y < height) {
-    if (image->pixel(x, y) != target_color &&
-        image->pixel(x, y) != border_color)
+    if (pixelAt(x, y) != target_color && pixelAt(x, y) != border_color)
       return true;
   }
 
@@ -816,61 +1066,57 @@ bool Drawer::_recursiveFloodFillTest(int x, int y, QRgb target_color,
 
 // stack based implementation
 void Drawer::fillFloodStack(QPoint start, QRgb target_color) {
-  QRgb start_color = image->pixel(start);
+  QRgb start_color = pixelAt(start.x(), start.y());
 
-  DebugWindow* debug_window;
-  if (debug) {
-    debug_window = new DebugWindow(image);
-  }
+  StepTrace* step_trace = beginTrace();
 
   QStack<QPoint> stack;
   stack.push(start);
+  int steps = 0;
 
   while (!stack.isEmpty()) {
+    if ((++steps & 4095) == 0 && !reportProgress(steps, width * height)) break;
+
     QPoint point = stack.pop();
     int x, y;
 
     x = point.x();
     y = point.y() - 1;
     if (x >= 0 && x < width && y >= 0 && y < height) {
-      if (image->pixel(x, y) != target_color &&
-          image->pixel(x, y) == start_color)
+      if (pixelAt(x, y) != target_color && pixelAt(x, y) == start_color)
         stack.push(QPoint(x, y));
     }
 
     x = point.x() + 1;
     y = point.y();
     if (x >= 0 && x < width && y >= 0 && y < height) {
-      if (image->pixel(x, y) != target_color &&
-          image->pixel(x, y) == start_color)
+      if (pixelAt(x, y) != target_color && pixelAt(x, y) == start_color)
         stack.push(QPoint(x, y));
     }
 
     x = point.x();
     y = point.y() + 1;
     if (x >= 0 && x < width && y >= 0 && y < height) {
-      if (image->pixel(x, y) != target_color &&
-          image->pixel(x, y) == start_color)
+      if (pixelAt(x, y) != target_color && pixelAt(x, y) == start_color)
         stack.push(QPoint(x, y));
     }
 
     x = point.x() - 1;
     y = point.y();
     if (x >= 0 && x < width && y >= 0 && y < height) {
-      if (image->pixel(x, y) != target_color &&
-          image->pixel(x, y) == start_color)
+      if (pixelAt(x, y) != target_color && pixelAt(x, y) == start_color)
         stack.push(QPoint(x, y));
     }
 
     drawPoint(point, target_color);
 
-    if (debug) {
-      debug_window->redraw();
-      DebugWindow::waitFor(1);
+    if (step_trace != nullptr) {
+      step_trace->beginStep();
+      step_trace->addSpan(point.y(), point.x(), point.x());
     }
   }
 
-  if (debug) delete debug_window;
+  endTrace(step_trace);
 }
 
 
@@ -915,64 +1161,556 @@ QTransform Drawer::createShearMatrix(qreal shear_x, qreal shear_y,
 }
 
 void Drawer::transform(QTransform transformation) {
+  if (tiles != nullptr) {
+    qWarning() << "Transformations are not supported on a tiled canvas";
+    return;
+  }
+
   // question: can under any circumstances result image have different (bigger)
   // dimensions than canvas image?
-  QImage temp(width, height, QImage::Format_ARGB32);
-  QRgb* temp_bits = (QRgb*)temp.bits();
+  // result is rendered to back buffer, which is only allocated when canvas
+  // dimensions change
+  allocateBackBuffer();
+  QRgb* temp_bits = (QRgb*)back_buffer.bits();
+
+  StepTrace* step_trace = beginTrace();
+
+
+  // always invert because of reverse mapping (org := res * M^-1, res := org)
+  transformation = transformation.inverted();
+
+  // strong downscales read from a smaller level of mip pyramid, with
+  // coordinates mapped to it
+  source_bits = bits;
+  source_width = width;
+  source_height = height;
+  source_stride = stride;
+  if (mipmaps != nullptr) {
+    // pyramid has to know about pixels changed since canvas last redrew
+    for (const QRect& rect : dirtyRegion()) mipmaps->invalidate(rect);
+
+    qreal footprint = transformation.type() <= QTransform::TxScale
+                          ? qMin(fabs(transformation.m11()),
+                                 fabs(transformation.m22()))
+                          : sqrt(fabs(transformation.determinant()));
+    int n = mipmaps->levelFor(footprint);
+    if (n > 0) {
+      const QImage& level = mipmaps->level(n);
+      source_bits = (const QRgb*)level.constBits();
+      source_width = level.width();
+      source_height = level.height();
+      source_stride = level.bytesPerLine() / sizeof(QRgb);
+
+      const qreal s = 1.0 / (1 << n);
+      const qreal c = ((1 << n) - 1) / 2.0;  // centre of a block of pixels
+      transformation *= QTransform(s, 0, 0, s, -c * s, -c * s);
+    }
+  }
+
+  // debugging traces progress of generic resampling, which other paths skip
+  bool completed;
+  if (step_trace != nullptr)
+    completed = resample(transformation, temp_bits, step_trace);
+  else if (transformation.type() <= QTransform::TxScale)
+    completed = resize(transformation, temp_bits);
+  else if (isWorthMapping(transformation))
+    completed = resampleCached(transformation, temp_bits);
+  else
+    completed = resample(transformation, temp_bits);
+
+  // cancelled; image has not been touched yet
+  if (!completed) {
+    trace = StepTrace();
+    return;
+  }
 
-  // initialize to (0, 0, 0, 0)
+  // buffers are swapped instead of copying result to canvas image, unless
+  // pixels have to stay where they are
+  saveForUndo(image->rect());
+  presentBackBuffer();
+  markDirty(image->rect());
+  endTrace(step_trace);
+}
+
+// returns false when cancelled; each band of tiles is a step of `_trace`
+bool Drawer::resample(const QTransform& inverse, QRgb* result,
+                      StepTrace* _trace) {
+  // only pixels of [span_from, span_to] in each row can map inside the
+  // source; the rest gets the same colour interpolation gives outside of it
+  span_from.resize(height);
+  span_to.resize(height);
+  const QRgb outside_color = qRgb(0, 0, 0);
   for (int y = 0; y < height; ++y) {
-    const int y_offset = y * width;
-    for (int x = 0; x < width; ++x) {
-      temp_bits[y_offset + x] = 0;
+    sourceRowSpan(inverse, y, span_from[y], span_to[y]);
+
+    QRgb* line = result + y * stride;
+    if (span_from[y] > span_to[y]) {
+      std::fill(line, line + width, outside_color);
+    } else {
+      std::fill(line, line + span_from[y], outside_color);
+      std::fill(line + span_to[y] + 1, line + width, outside_color);
     }
   }
 
-  DebugWindow* debug_window;
-  if (debug) debug_window = new DebugWindow(&temp);
+  // pick interpolation function once instead of in each loop iteration
+  QRgb (Drawer::*interpolate)(QPointF) = &Drawer::interpolateNearest;
+  if (interpolation_type == InterpolationType::bilinear)
+    interpolate = &Drawer::interpolateBilinear;
+
+  // destination is walked in square tiles, so that source pixels read for one
+  // tile (rotated and scaled square) stay in cache; 0 means plain row order
+  const bool tiled = transform_tile_size > 0;
+  const int tile = tiled ? transform_tile_size : qMax(width, height);
+
+  for (int tile_y = 0; tile_y < height; tile_y += tile) {
+    if (!reportProgress(tile_y, height)) return false;
+    const int tile_bottom = qMin(tile_y + tile, height);
+
+    for (int tile_x = 0; tile_x < width; tile_x += tile) {
+      const int tile_right = qMin(tile_x + tile, width);
+
+      if (tiled && transform_prefetch) {
+        // next tile in traversal order
+        if (tile_right < width)
+          prefetchSourceTile(inverse, QRect(tile_right, tile_y, tile, tile));
+        else if (tile_bottom < height)
+          prefetchSourceTile(inverse, QRect(0, tile_bottom, tile, tile));
+      }
 
+      for (int y = tile_y; y < tile_bottom; ++y) {
+        const int y_offset = y * stride;
+        const int x_from = qMax(tile_x, span_from[y]);
+        const int x_to = qMin(tile_right - 1, span_to[y]);
+        for (int x = x_from; x <= x_to; ++x) {
+          // QPointF needed for interpolation
+          QPointF source_pixel = QPointF(x, y) * inverse;
+          result[y_offset + x] = (this->*interpolate)(source_pixel);
+        }
+      }
+    }
 
-  // always invert because of reverse mapping (org := res * M^-1, res := org)
-  transformation = transformation.inverted();
+    if (_trace != nullptr) {
+      _trace->beginStep();
+      for (int y = tile_y; y < tile_bottom; ++y)
+        _trace->addSpan(y, 0, width - 1);
+    }
+  }
+
+  return true;
+}
+
+TransformMapKey Drawer::transformMapKey(const QTransform& inverse) const {
+  return {inverse, width, height, source_stride, interpolation_type};
+}
+
+// building a map costs a full pass and width * height indices, so it is done
+// only for a transformation seen before whose map fits into the cache; others
+// go through the tiled resampling without any allocation
+bool Drawer::isWorthMapping(const QTransform& inverse) {
+  const qint64 cost = qMax(qint64(1), qint64(width) * height / 256);
+  if (cost > transform_cache.maxCost()) return false;
+
+  const TransformMapKey key = transformMapKey(inverse);
+  if (transform_cache.contains(key)) return true;
+  if (transform_seen.removeAll(key) > 0) return true;
+
+  transform_seen.push_back(key);
+  const int remembered = 16;
+  if (transform_seen.size() > remembered) transform_seen.removeFirst();
+
+  return false;
+}
+
+// repeated transformations (like a rotation applied many times) only gather
+// pixels through a map of source indices computed once
+bool Drawer::resampleCached(const QTransform& inverse, QRgb* result) {
+  const TransformMapKey key = transformMapKey(inverse);
+
+  QVector<qint32>* map = transform_cache.object(key);
+  const bool cached = map != nullptr;
+  if (!cached) map = createTransformMap(inverse);
+  if (map == nullptr) return false;
+
+  // map is dense, result rows can be padded
+  const QRgb outside_color = qRgb(0, 0, 0);
+  const bool bilinear = interpolation_type == InterpolationType::bilinear;
+  for (int y = 0; y < height; ++y) {
+    // cancelling here keeps the complete map
+    if (!reportProgress(height + y, 2 * height)) {
+      if (!cached)
+        transform_cache.insert(key, map, qMax(1, int(map->size() / 256)));
+      return false;
+    }
+
+    const qint32* index = map->constData() + y * width;
+    QRgb* line = result + y * stride;
+    if (bilinear) {
+      for (int x = 0; x < width; ++x)
+        line[x] = index[x] >= 0 ? blendBilinear(index[x]) : outside_color;
+    } else {
+      for (int x = 0; x < width; ++x)
+        line[x] = index[x] >= 0 ? source_bits[index[x]] : outside_color;
+    }
+  }
+
+  // cache takes ownership
+  if (!cached)
+    transform_cache.insert(key, map, qMax(1, int(map->size() / 256)));
+
+  return true;
+}
+
+QVector<qint32>* Drawer::createTransformMap(const QTransform& inverse) {
+  QVector<qint32>* map = new QVector<qint32>(width * height, -1);
+  qint32* index = map->data();
+
+  int (Drawer::*sourceIndex)(QPointF) = &Drawer::nearestSourceIndex;
+  if (interpolation_type == InterpolationType::bilinear)
+    sourceIndex = &Drawer::bilinearSourceIndex;
 
   for (int y = 0; y < height; ++y) {
+    if (!reportProgress(y, 2 * height)) {
+      delete map;
+      return nullptr;
+    }
+
+    int x_from, x_to;
+    sourceRowSpan(inverse, y, x_from, x_to);
+
     const int y_offset = y * width;
-    for (int x = 0; x < width; ++x) {
-      // QPointF needed for interpolation
-      QPointF source_pixel = QPointF(x, y) * transformation;
+    for (int x = x_from; x <= x_to; ++x)
+      index[y_offset + x] = (this->*sourceIndex)(QPointF(x, y) * inverse);
+  }
+
+  return map;
+}
 
-      // TODO how to switch between interpolation functions without if in each
-      // loop iteration?
-      QRgb result_color;
-      switch (interpolation_type) {
-        case InterpolationType::nearest: {
-          result_color = interpolateNearest(source_pixel);
+/*  SEPARABLE RESIZE  */
 
-        } break;
-        case InterpolationType::bilinear: {
-          result_color = interpolateBilinear(source_pixel);
+static const int RESIZE_SHIFT = 14;  // fixed point precision of weights
 
-        } break;
+static inline int resizeChannel(int sum) {
+  return qBound(0, (sum + (1 << (RESIZE_SHIFT - 1))) >> RESIZE_SHIFT, 255);
+}
+
+// pure scaling (and translation) resampled with a horizontal and a vertical
+// pass of precomputed 1D filters; downscales average whole footprint of a
+// destination pixel instead of picking at most four source pixels
+bool Drawer::resize(const QTransform& inverse, QRgb* result) {
+  buildResizeFilter(resize_filter_x, inverse.m11(), inverse.m31(), width,
+                    source_width);
+  buildResizeFilter(resize_filter_y, inverse.m22(), inverse.m32(), height,
+                    source_height);
+  const QRgb outside_color = qRgb(0, 0, 0);
+
+  // horizontal pass, source rows -> intermediate rows
+  resize_buffer.resize(width * source_height);
+  QRgb* buffer = resize_buffer.data();
+  const int* first = resize_filter_x.first.constData();
+  const int* index = resize_filter_x.index.constData();
+  const int* weight = resize_filter_x.weight.constData();
+  const int total = source_height + height;
+  for (int y = 0; y < source_height; ++y) {
+    if (!reportProgress(y, total)) return false;
+
+    const QRgb* line = source_bits + y * source_stride;
+    QRgb* out = buffer + y * width;
+    for (int x = 0; x < width; ++x) {
+      int red = 0, green = 0, blue = 0, alpha = 0;
+      for (int t = first[x]; t < first[x + 1]; ++t) {
+        QRgb color = index[t] >= 0 ? line[index[t]] : outside_color;
+        red += qRed(color) * weight[t];
+        green += qGreen(color) * weight[t];
+        blue += qBlue(color) * weight[t];
+        alpha += qAlpha(color) * weight[t];
       }
+      out[x] = qRgba(resizeChannel(red), resizeChannel(green),
+                     resizeChannel(blue), resizeChannel(alpha));
+    }
+  }
 
+  // vertical pass, whole intermediate rows are accumulated at once
+  resize_accumulator.resize(4 * width);
+  int* sum = resize_accumulator.data();
+  first = resize_filter_y.first.constData();
+  index = resize_filter_y.index.constData();
+  weight = resize_filter_y.weight.constData();
+  for (int y = 0; y < height; ++y) {
+    if (!reportProgress(source_height + y, total)) return false;
+    std::fill(sum, sum + 4 * width, 0);
+
+    for (int t = first[y]; t < first[y + 1]; ++t) {
+      if (index[t] < 0) {
+        for (int x = 0; x < width; ++x)
+          sum[4 * x + 3] += qAlpha(outside_color) * weight[t];
+        continue;
+      }
 
-      temp_bits[y_offset + x] = result_color;
+      const QRgb* line = buffer + index[t] * width;
+      for (int x = 0; x < width; ++x) {
+        sum[4 * x] += qRed(line[x]) * weight[t];
+        sum[4 * x + 1] += qGreen(line[x]) * weight[t];
+        sum[4 * x + 2] += qBlue(line[x]) * weight[t];
+        sum[4 * x + 3] += qAlpha(line[x]) * weight[t];
+      }
     }
 
-    if (debug) {
-      DebugWindow::waitFor(2);
-      debug_window->redraw();
+    QRgb* out = result + y * stride;
+    for (int x = 0; x < width; ++x)
+      out[x] = qRgba(resizeChannel(sum[4 * x]), resizeChannel(sum[4 * x + 1]),
+                     resizeChannel(sum[4 * x + 2]),
+                     resizeChannel(sum[4 * x + 3]));
+  }
+
+  return true;
+}
+
+// computes source pixels and weights for each destination pixel of one axis,
+// where destination pixel `i` is centred at source position scale * i + offset
+void Drawer::buildResizeFilter(ResizeFilter& filter, qreal scale, qreal offset,
+                               int destination_length, int source_length) {
+  filter.first.resize(destination_length + 1);
+  filter.index.resize(0);
+  filter.weight.resize(0);
+
+  auto addTap = [&](int source, qreal weight) {
+    int fixed = qRound(weight * (1 << RESIZE_SHIFT));
+    if (fixed == 0) return;
+    filter.index.append((source >= 0 && source < source_length) ? source : -1);
+    filter.weight.append(fixed);
+  };
+
+  const qreal footprint = fabs(scale);
+  for (int i = 0; i < destination_length; ++i) {
+    filter.first[i] = filter.index.size();
+    const qreal centre = scale * i + offset;
+
+    if (footprint > 1) {
+      // box filter, weight of a source pixel is its overlap with footprint
+      const qreal left = centre - footprint / 2;
+      const qreal right = centre + footprint / 2;
+      for (int j = floor(left + 0.5); j <= floor(right + 0.5); ++j) {
+        qreal overlap = qMin(right, j + 0.5) - qMax(left, j - 0.5);
+        if (overlap > 0) addTap(j, overlap / footprint);
+      }
+    } else if (interpolation_type == InterpolationType::nearest) {
+      addTap(round(centre), 1.0);
+    } else {
+      const int j = floor(centre);
+      const qreal fraction = centre - j;
+      addTap(j, 1.0 - fraction);
+      addTap(j + 1, fraction);
     }
   }
+  filter.first[destination_length] = filter.index.size();
+}
 
-  if (debug) delete debug_window;
+// finds the range of x in destination row `y` whose inverse image lands in
+// the (one pixel wider) source rectangle; interpolation functions still check
+// exact bounds, so the range only has to be conservative
+void Drawer::sourceRowSpan(const QTransform& inverse, int y, int& x_from,
+                           int& x_to) {
+  x_from = 0;
+  x_to = width - 1;
+  if (!inverse.isAffine()) return;
+
+  // source coordinates along the row are linear in x: s(x) = a * x + b
+  qreal from = 0;
+  qreal to = width - 1;
+  const qreal a[2] = {inverse.m11(), inverse.m12()};
+  const qreal b[2] = {inverse.m21() * y + inverse.m31(),
+                      inverse.m22() * y + inverse.m32()};
+  const qreal lo[2] = {-1, -1};
+  const qreal hi[2] = {qreal(source_width), qreal(source_height)};
+
+  for (int i = 0; i < 2; ++i) {
+    if (qFuzzyIsNull(a[i])) {
+      if (b[i] < lo[i] || b[i] > hi[i]) to = from - 1;  // whole row outside
+      continue;
+    }
+    qreal x0 = (lo[i] - b[i]) / a[i];
+    qreal x1 = (hi[i] - b[i]) / a[i];
+    if (x0 > x1) std::swap(x0, x1);
+    from = qMax(from, x0);
+    to = qMin(to, x1);
+  }
+
+  if (from > to) {
+    x_from = 1;
+    x_to = 0;
+    return;
+  }
+
+  // one pixel of slack for rounding errors
+  x_from = qMax(0, int(floor(from)) - 1);
+  x_to = qMin(width - 1, int(ceil(to)) + 1);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(_address) __builtin_prefetch(_address)
+#else
+#define PREFETCH(_address)
+#endif
+
+// requests source pixels that destination `tile` will read, so they are
+// already in cache when the tile is resampled
+void Drawer::prefetchSourceTile(const QTransform& inverse, QRect tile) {
+  QRect footprint =
+      inverse.mapRect(tile) & QRect(0, 0, source_width, source_height);
+
+  // strong downscales read sparsely from a huge footprint, skip them
+  if (footprint.width() * footprint.height() > 4 * tile.width() * tile.height())
+    return;
+
+  const int pixels_per_line = 64 / sizeof(QRgb);  // typical cache line
+  for (int y = footprint.top(); y <= footprint.bottom(); ++y) {
+    const QRgb* line = source_bits + y * source_stride;
+    for (int x = footprint.left(); x <= footprint.right();
+         x += pixels_per_line)
+      PREFETCH(line + x);
+    PREFETCH(line + footprint.right());
+  }
+}
 
-  // copy result to canvas image
+#undef PREFETCH
+
+
+/*  THREE SHEAR ROTATION ("Paeth")  */
+
+// rotation decomposed into shears x -> y -> x, each of them being a pass of
+// 1D shifts of whole rows or columns
+void Drawer::rotateThreeShear(qreal theta_degrees, bool in_place) {
+  if (tiles != nullptr) {
+    qWarning() << "Transformations are not supported on a tiled canvas";
+    return;
+  }
+
+  const int centre_x = in_place ? width / 2 : 0;
+  const int centre_y = in_place ? height / 2 : 0;
+
+  // any angle is brought to (-180, 180] first, so at most one half turn
+  // leaves |theta| <= 90 degrees for the shears
+  theta_degrees = fmod(theta_degrees, 360);
+  if (theta_degrees > 180) theta_degrees -= 360;
+  if (theta_degrees <= -180) theta_degrees += 360;
+
+  // shears get unstable near 180 degrees, so half turn is done exactly
+  const bool half_turn = theta_degrees > 90 || theta_degrees < -90;
+  if (half_turn) {
+    saveForUndo(image->rect());
+    rotateHalfTurn(centre_x, centre_y);
+    theta_degrees += theta_degrees > 0 ? -180 : 180;
+  }
+
+  // image is only written by the last pass, so the first two can be
+  // cancelled (unless the half turn has already changed it)
+  const int total = 2 * height + width;
+  auto cancelled = [&](int done) {
+    return !reportProgress(done, total) && !half_turn;
+  };
+
+  qreal theta = theta_degrees * M_PI / 180;
+  const qreal alpha = -tan(theta / 2);  // shear of both x passes
+  const qreal beta = sin(theta);        // shear of y pass
+
+  // rows of intermediate image are wider by the biggest x shear on each side
+  const int pad =
+      ceil(fabs(alpha) * qMax(centre_y, height - 1 - centre_y)) + 1;
+  const int buffer_width = width + 2 * pad;
+  shear_buffer.resize(buffer_width * height);
+  QRgb* buffer = shear_buffer.data();
+
+  // x shear: image -> buffer
   for (int y = 0; y < height; ++y) {
-    const int y_offset = y * width;
+    if (cancelled(y)) return;
+    qreal shift = alpha * (y - centre_y);
+    shiftLine(bits + y * stride, width, buffer + y * buffer_width,
+              buffer_width, -pad - shift);
+  }
+
+  // y shear: buffer -> buffer, one column at a time
+  shear_line_in.resize(height);
+  shear_line_out.resize(height);
+  QRgb* column_in = shear_line_in.data();
+  QRgb* column_out = shear_line_out.data();
+  for (int column = 0; column < buffer_width; ++column) {
+    if (cancelled(height + column * width / buffer_width)) return;
+    qreal shift = beta * (column - pad - centre_x);
+
+    for (int y = 0; y < height; ++y)
+      column_in[y] = buffer[y * buffer_width + column];
+    shiftLine(column_in, height, column_out, height, -shift);
+    for (int y = 0; y < height; ++y)
+      buffer[y * buffer_width + column] = column_out[y];
+  }
+
+  // x shear: buffer -> image
+  saveForUndo(image->rect());
+  for (int y = 0; y < height; ++y) {
+    qreal shift = alpha * (y - centre_y);
+    shiftLine(buffer + y * buffer_width, buffer_width, bits + y * stride,
+              width, pad - shift);
+  }
+
+  markDirty(image->rect());
+}
+
+// exact rotation by 180 degrees around (centre_x, centre_y)
+void Drawer::rotateHalfTurn(int centre_x, int centre_y) {
+  allocateBackBuffer();
+  QRgb* temp_bits = (QRgb*)back_buffer.bits();
+
+  for (int y = 0; y < height; ++y) {
+    const int source_y = 2 * centre_y - y;
     for (int x = 0; x < width; ++x) {
-      bits[y_offset + x] = temp_bits[y_offset + x];
+      const int source_x = 2 * centre_x - x;
+      QRgb color = qRgb(0, 0, 0);
+      if (source_x >= 0 && source_x < width && source_y >= 0 &&
+          source_y < height)
+        color = bits[source_y * stride + source_x];
+      temp_bits[y * stride + x] = color;
+    }
+  }
+
+  presentBackBuffer();
+}
+
+// blends two colors, weight is in range [0, 256]
+static inline QRgb lerpColors(QRgb a, QRgb b, int weight) {
+  const int inverse = 256 - weight;
+  int alpha = (qAlpha(a) * inverse + qAlpha(b) * weight) >> 8;
+  int red = (qRed(a) * inverse + qRed(b) * weight) >> 8;
+  int green = (qGreen(a) * inverse + qGreen(b) * weight) >> 8;
+  int blue = (qBlue(a) * inverse + qBlue(b) * weight) >> 8;
+
+  return qRgba(red, green, blue, alpha);
+}
+
+// fills `destination` with `source` read from position (i + offset); all
+// pixels share the same fraction, pixels outside of source are black
+void Drawer::shiftLine(const QRgb* source, int source_length,
+                       QRgb* destination, int destination_length,
+                       qreal offset) {
+  const QRgb outside_color = qRgb(0, 0, 0);
+
+  if (interpolation_type == InterpolationType::nearest) {
+    const int whole = floor(offset + 0.5);
+    for (int i = 0; i < destination_length; ++i) {
+      const int a = i + whole;
+      destination[i] =
+          (a >= 0 && a < source_length) ? source[a] : outside_color;
     }
+    return;
+  }
+
+  const int whole = floor(offset);
+  const int weight = (offset - whole) * 256;
+  for (int i = 0; i < destination_length; ++i) {
+    const int a = i + whole;
+    QRgb left = (a >= 0 && a < source_length) ? source[a] : outside_color;
+    QRgb right =
+        (a + 1 >= 0 && a + 1 < source_length) ? source[a + 1] : outside_color;
+    destination[i] = lerpColors(left, right, weight);
   }
 }
 
@@ -981,14 +1719,31 @@ void Drawer::transform(QTransform transformation) {
 /*  INTERPOLATION FUNCTIONS  */
 
 // TODO optimise both color picking functions
+// index of pixel in source bits, or -1 if coordinates are outside of source
+int Drawer::nearestSourceIndex(QPointF coordinates) {
+  int x = round(coordinates.x());
+  int y = round(coordinates.y());
+  if (x >= 0 && x < source_width && y >= 0 && y < source_height)
+    return y * source_stride + x;
+
+  return -1;
+}
+
+// index of top left pixel out of four blended together, or -1
+int Drawer::bilinearSourceIndex(QPointF coordinates) {
+  int x = coordinates.x();
+  int y = coordinates.y();
+  if (x >= 0 && x + 1 < source_width && y >= 0 && y + 1 < source_height)
+    return y * source_stride + x;
+
+  return -1;
+}
+
 QRgb Drawer::interpolateNearest(QPointF coordinates) {
   QRgb color = qRgb(0, 0, 0);  // default value is black
 
-  int x = round(coordinates.x());
-  int y = round(coordinates.y());
-  if (x >= 0 && x < width && y >= 0 && y < height) {
-    color = image->pixel(x, y);
-  }
+  int index = nearestSourceIndex(coordinates);
+  if (index >= 0) color = source_bits[index];
 
   return color;
 }
@@ -1004,28 +1759,30 @@ QRgb Drawer::interpolateNearest(QPointF coordinates) {
 QRgb Drawer::interpolateBilinear(QPointF coordinates) {
   QRgb color = qRgb(0, 0, 0);  // default value is black
 
-  int x = coordinates.x();
-  int y = coordinates.y();
-  if (x >= 0 && x + 1 < width && y >= 0 && y + 1 < height) {
-    QColor p02;
-    {
-      QColor p0 = image->pixelColor(x, y);
-      QColor p2 = image->pixelColor(x, y + 1);
-      BLEND_COLORS(0, 2);
-    }
-    QColor p13;
-    {
-      QColor p1 = image->pixelColor(x + 1, y);
-      QColor p3 = image->pixelColor(x + 1, y + 1);
-      BLEND_COLORS(1, 3);
-    }
-    QColor p0213;
-    { BLEND_COLORS(02, 13); }
+  int index = bilinearSourceIndex(coordinates);
+  if (index >= 0) color = blendBilinear(index);
 
-    color = p0213.rgba();
+  return color;
+}
+
+// blends pixel at `index` with its right, bottom and bottom right neighbours
+QRgb Drawer::blendBilinear(int index) {
+  QColor p02;
+  {
+    QColor p0 = QColor::fromRgba(source_bits[index]);
+    QColor p2 = QColor::fromRgba(source_bits[index + source_stride]);
+    BLEND_COLORS(0, 2);
+  }
+  QColor p13;
+  {
+    QColor p1 = QColor::fromRgba(source_bits[index + 1]);
+    QColor p3 = QColor::fromRgba(source_bits[index + source_stride + 1]);
+    BLEND_COLORS(1, 3);
   }
+  QColor p0213;
+  { BLEND_COLORS(02, 13); }
 
-  return color;
+  return p0213.rgba();
 }
 
 #undef BLEND_COLORS
@@ -2,8 +2,45 @@
 #define DRAWER_H
 
 #include <QtWidgets>
-#include "debugwindow.h"
+#include <functional>
+#include "mippyramid.h"
 #include "settings.h"
+#include "steptrace.h"
+#include "tiledimage.h"
+#include "undohistory.h"
+
+// identifies map of source pixels computed for a transformation
+struct TransformMapKey {
+  QTransform inverse;
+  int width;
+  int height;
+  int source_stride;  // map holds indices into rows of this length
+  InterpolationType interpolation_type;
+
+  bool operator==(const TransformMapKey& other) const {
+    return inverse == other.inverse && width == other.width &&
+           height == other.height && source_stride == other.source_stride &&
+           interpolation_type == other.interpolation_type;
+  }
+};
+
+inline uint qHash(const TransformMapKey& key, uint seed = 0) {
+  uint hash = seed ^ uint(key.width) ^ (uint(key.height) << 16) ^
+              (uint(key.source_stride) << 8) ^ uint(key.interpolation_type);
+  const qreal m[6] = {key.inverse.m11(), key.inverse.m12(),
+                      key.inverse.m21(), key.inverse.m22(),
+                      key.inverse.m31(), key.inverse.m32()};
+  for (qreal v : m) hash = 31 * hash + qHash(v);
+
+  return hash;
+}
+
+// per axis contributions of source pixels to destination pixels of a resize
+struct ResizeFilter {
+  QVector<int> first;   // first tap of each destination pixel (and the end)
+  QVector<int> index;   // source pixel of a tap, -1 if outside of the image
+  QVector<int> weight;  // fixed point weight of a tap
+};
 
 class Drawer {
  public:
@@ -13,7 +50,22 @@ class Drawer {
                   int _circle_steps, FillType _fill_type,
                   InterpolationType _interpolation_type);
 
-  void setImage(QImage* _image);
+  // `_fixed_buffer` keeps pixels in the buffer of the image (mapped files),
+  // transformations then copy their results back instead of swapping buffers
+  void setImage(QImage* _image, bool _fixed_buffer = false);
+  // draws on pixels owned by the caller, without copying them; they must
+  // stay valid while drawer uses them. Only ARGB32 is supported, false is
+  // returned for other formats. Mipmaps and history are detached, set them
+  // again for the buffer if needed
+  bool setBuffer(uchar* _data, int _width, int _height, int _bytes_per_line,
+                 QImage::Format _format = QImage::Format_ARGB32);
+  void setTiledImage(TiledImage* _tiles);
+
+  // working format: ARGB32 with rows aligned to ROW_ALIGNMENT bytes
+  static const int ROW_ALIGNMENT = 64;
+  static QImage createAlignedImage(int _width, int _height);
+  static QImage toWorkingFormat(const QImage& _image);
+  static bool isWorkingFormat(const QImage& _image);
   void setMainColor(QRgb _main_color);
   void setDebug(bool _debug, QRgb _debug_color);
 
@@ -23,6 +75,19 @@ class Drawer {
   void setInterpolationType(InterpolationType _interpolation_type);
   void setCircleSteps(int _circle_steps);
 
+  QRegion dirtyRegion() const;
+  void resetDirtyRegion();
+  void setMipmaps(MipPyramid* _mipmaps);
+  void setTransformTiling(int _tile_size, bool _prefetch);
+  void setTransformCache(int _megabytes);
+  // long operations report (done, total) work units to `_callback` and stop
+  // early when it returns false
+  void setProgressCallback(std::function<bool(int, int)> _callback);
+  // traces of operations run in debug mode since the previous call
+  QVector<StepTrace> takeTraces();
+  // tiles are saved to `_history` before operations write into them
+  void setHistory(UndoHistory* _history);
+
 
   /*  DRAWING  */
   void drawPoint(QPoint point);
@@ -40,6 +105,7 @@ class Drawer {
   void drawApproximatedCircle(QPoint centre, QPoint range, const int segments);
 
   void drawPolygon(QVector<QPoint>& points);
+  void drawPolyline(const QVector<QPoint>& points);
 
   void drawBezierCurve(QPoint p0, QPoint p1, QPoint p2, QPoint p3);
 
@@ -65,6 +131,7 @@ class Drawer {
   QTransform createShearMatrix(qreal shear_x, qreal shear_y, bool in_place);
 
   void transform(QTransform transformation);
+  void rotateThreeShear(qreal theta_degrees, bool in_place);
 
  protected:
   void drawPoint(QPoint point, QRgb color);
@@ -78,21 +145,71 @@ class Drawer {
 
  private:
   QImage* image;
+  TiledImage* tiles = nullptr;  // replaces image when set
 
   QRgb main_color;  // private drawing functions don't use it directly
   bool debug = false;
   QRgb debug_color;
+  std::function<bool(int, int)> progress_callback;
+  StepTrace trace;  // being recorded
+  QVector<StepTrace> traces;
 
   LineType line_type;
   CircleType circle_type;
   FillType fill_type;
   InterpolationType interpolation_type;
   int circle_steps;
+  int transform_tile_size = 64;  // in pixels, 0 disables tiling
+  bool transform_prefetch = true;
+
+  // pixels changed by operations, until canvas resets it
+  QRegion dirty_region;
+  int dirty_left;
+  int dirty_top;
+  int dirty_right;
+  int dirty_bottom;
+  inline void markDirty(int x, int y);
+  void markDirty(QRect rect);
+  UndoHistory* history = nullptr;
+  void saveForUndo(QRect rect);
+
+  inline QRgb pixelAt(int x, int y);
+  inline void setPixelAt(int x, int y, QRgb color);
 
   int width;
   int height;
+  int stride;  // pixels between starts of rows, rows can be padded
   QRgb* bits;  // speed up; possibly it can cause problems, not sure
 
+  // pixels read by interpolation, either bits or a level of mip pyramid
+  MipPyramid* mipmaps = nullptr;
+  const QRgb* source_bits;
+  int source_width;
+  int source_height;
+  int source_stride;
+
+  // transformations render here and swap it with image, so it has the same
+  // layout of rows
+  QImage back_buffer;
+  bool fixed_buffer = false;
+  QImage buffer_view;  // over pixels given to setBuffer(), owns nothing
+  void allocateBackBuffer();
+  void presentBackBuffer();
+  QVector<int> span_from;
+  QVector<int> span_to;
+  // source pixel index for each destination pixel (-1 when outside), LRU
+  QCache<TransformMapKey, QVector<qint32>> transform_cache{0};
+  QList<TransformMapKey> transform_seen;  // recent ones without a map
+  // filters and intermediate buffers of separable resize
+  ResizeFilter resize_filter_x;
+  ResizeFilter resize_filter_y;
+  QVector<QRgb> resize_buffer;
+  QVector<int> resize_accumulator;
+  // intermediate image and line buffers of three shear rotation
+  QVector<QRgb> shear_buffer;
+  QVector<QRgb> shear_line_in;
+  QVector<QRgb> shear_line_out;
+
   /*  Line and circle helper methods  */
   inline int determineOctant(QPoint start, QPoint end);
   inline void swapInputs(int& outx, int& outy, const int octant);
@@ -114,11 +231,33 @@ class Drawer {
   inline bool _recursiveFloodFillTest(int x, int y, QRgb target_color,
                                       QRgb border_color);
 
+  StepTrace* beginTrace();
+  void endTrace(StepTrace* _trace);
+  inline bool reportProgress(int done, int total);
+
   QTransform toInplaceTransformation(QTransform matrix);
+  bool resample(const QTransform& inverse, QRgb* result,
+                StepTrace* _trace = nullptr);
+  TransformMapKey transformMapKey(const QTransform& inverse) const;
+  bool isWorthMapping(const QTransform& inverse);
+  bool resampleCached(const QTransform& inverse, QRgb* result);
+  QVector<qint32>* createTransformMap(const QTransform& inverse);
+  bool resize(const QTransform& inverse, QRgb* result);
+  void buildResizeFilter(ResizeFilter& filter, qreal scale, qreal offset,
+                         int destination_length, int source_length);
+  void prefetchSourceTile(const QTransform& inverse, QRect tile);
+  void rotateHalfTurn(int centre_x, int centre_y);
+  void shiftLine(const QRgb* source, int source_length, QRgb* destination,
+                 int destination_length, qreal offset);
+  void sourceRowSpan(const QTransform& inverse, int y, int& x_from,
+                     int& x_to);
 
   // image member is always a source for color values
   QRgb interpolateNearest(QPointF coordinates);
   QRgb interpolateBilinear(QPointF coordinates);
+  int nearestSourceIndex(QPointF coordinates);
+  int bilinearSourceIndex(QPointF coordinates);
+  QRgb blendBilinear(int index);
 };
 
 #endif  // DRAWER_H
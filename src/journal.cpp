@@ -0,0 +1,301 @@
+#include "journal.h"
+
+static const quint32 MAGIC = 0x514d504a;  // "QMPJ"
+// 2 added clips of loads, 3 fixed the version of QDataStream
+static const quint16 VERSION = 3;
+static const QDataStream::Version STREAM_VERSION = QDataStream::Qt_5_0;
+
+static const char* MODE_NAMES[] = {"none",   "click",  "stroke",
+                                   "line",   "circle", "bezier",
+                                   "spline", "polygon", "fill"};
+static const char* OPERATION_NAMES[] = {"vgradient", "hgradient", "shift",
+                                        "rotate",    "scale",     "shear"};
+static const int MODE_COUNT = sizeof(MODE_NAMES) / sizeof(MODE_NAMES[0]);
+static const int OPERATION_COUNT =
+    sizeof(OPERATION_NAMES) / sizeof(OPERATION_NAMES[0]);
+
+// only settings changing results of drawing, not of displaying
+static QByteArray serialize(const Settings& s) {
+  QByteArray data;
+  QDataStream out(&data, QIODevice::WriteOnly);
+  out.setVersion(STREAM_VERSION);
+  out << qint8(s.mode) << qint8(s.line_type) << qint8(s.circle_type)
+      << s.fill_color << s.fill_random << qint8(s.fill_type) << s.start_color
+      << s.end_color << qint32(s.gradient_steps) << s.main_color
+      << qint32(s.circle_steps) << qint8(s.interpolation_type)
+      << qint32(s.transform_tile_size) << s.transform_prefetch
+      << qint32(s.transform_cache_size) << qint32(s.shift_x)
+      << qint32(s.shift_y) << s.rotate_angle << s.rotate_inplace
+      << qint8(s.rotation_type) << s.scale_x << s.scale_y << s.scale_inplace
+      << s.shear_x << s.shear_y << s.shear_inplace;
+
+  return data;
+}
+
+// enums are checked, so values from a corrupted file never index past names
+static bool deserialize(const QByteArray& data, Settings* settings) {
+  Settings& s = *settings;
+  QDataStream in(data);
+  in.setVersion(STREAM_VERSION);
+  qint8 mode, line_type, circle_type, fill_type, interpolation_type,
+      rotation_type;
+  qint32 gradient_steps, circle_steps, tile_size, cache_size, shift_x, shift_y;
+  in >> mode >> line_type >> circle_type >> s.fill_color >> s.fill_random >>
+      fill_type >> s.start_color >> s.end_color >> gradient_steps >>
+      s.main_color >> circle_steps >> interpolation_type >> tile_size >>
+      s.transform_prefetch >> cache_size >> shift_x >> shift_y >>
+      s.rotate_angle >> s.rotate_inplace >> rotation_type >> s.scale_x >>
+      s.scale_y >> s.scale_inplace >> s.shear_x >> s.shear_y >>
+      s.shear_inplace;
+  if (in.status() != QDataStream::Ok || mode < 0 || mode >= MODE_COUNT ||
+      line_type < 0 || line_type > int(LineType::antialiased) ||
+      circle_type < 0 || circle_type > int(CircleType::approximated) ||
+      fill_type < 0 || fill_type > int(FillType::recursive) ||
+      interpolation_type < 0 ||
+      interpolation_type > int(InterpolationType::bilinear) ||
+      rotation_type < 0 || rotation_type > int(RotationType::shears))
+    return false;
+
+  s.mode = Mode(mode);
+  s.line_type = LineType(line_type);
+  s.circle_type = CircleType(circle_type);
+  s.fill_type = FillType(fill_type);
+  s.gradient_steps = gradient_steps;
+  s.circle_steps = circle_steps;
+  s.interpolation_type = InterpolationType(interpolation_type);
+  s.transform_tile_size = tile_size;
+  s.transform_cache_size = cache_size;
+  s.shift_x = shift_x;
+  s.shift_y = shift_y;
+  s.rotation_type = RotationType(rotation_type);
+
+  return true;
+}
+
+// replay starts from a fresh canvas of the same size and kind
+bool Journal::start(QString file_name, const Settings& settings) {
+  stop();
+  file.setFileName(file_name);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qWarning() << "Journal cannot be written:" << file.errorString();
+    return false;
+  }
+
+  stream.setDevice(&file);
+  stream.setVersion(STREAM_VERSION);
+  stream << MAGIC << VERSION;
+  timer.start();
+  last_settings.clear();
+
+  recordResize(settings.width, settings.height);
+  recordTiled(settings.tiled);
+  writeSettings(settings);
+
+  return true;
+}
+
+void Journal::stop() {
+  if (!file.isOpen()) return;
+  stream.setDevice(nullptr);
+  file.close();
+}
+
+bool Journal::isRecording() const { return file.isOpen() && !suspended; }
+
+void Journal::suspend(bool _suspended) { suspended = _suspended; }
+
+void Journal::recordPress(const Settings& settings, QPoint point) {
+  if (!isRecording()) return;
+  writeSettings(settings);
+  begin(JournalEventType::press);
+  stream << qint32(point.x()) << qint32(point.y());
+}
+
+void Journal::recordOperation(const Settings& settings, Operation operation) {
+  if (!isRecording()) return;
+  writeSettings(settings);
+  begin(JournalEventType::operation);
+  stream << quint8(operation);
+}
+
+void Journal::recordSetupDraw(const Settings& settings) {
+  if (!isRecording()) return;
+  writeSettings(settings);
+  begin(JournalEventType::setup_draw);
+}
+
+void Journal::recordStroke(const Settings& settings,
+                           const QVector<QPoint>& points) {
+  if (!isRecording()) return;
+  writeSettings(settings);
+  begin(JournalEventType::stroke);
+  stream << points;
+}
+
+void Journal::recordLoad(QString file_name, QRect clip) {
+  if (!isRecording()) return;
+  begin(JournalEventType::load);
+  stream << file_name << clip;
+}
+
+void Journal::recordClear(QColor color) {
+  if (!isRecording()) return;
+  begin(JournalEventType::clear);
+  stream << color;
+}
+
+void Journal::recordResize(int width, int height) {
+  if (!isRecording()) return;
+  begin(JournalEventType::resize);
+  stream << qint32(width) << qint32(height);
+}
+
+void Journal::recordTiled(bool tiled) {
+  if (!isRecording()) return;
+  begin(JournalEventType::tiled);
+  stream << tiled;
+}
+
+void Journal::recordUndo() {
+  if (!isRecording()) return;
+  begin(JournalEventType::undo);
+}
+
+void Journal::recordRedo() {
+  if (!isRecording()) return;
+  begin(JournalEventType::redo);
+}
+
+void Journal::begin(JournalEventType type) {
+  stream << quint8(type) << quint32(timer.elapsed());
+}
+
+void Journal::writeSettings(const Settings& settings) {
+  const QByteArray data = serialize(settings);
+  if (data == last_settings) return;
+
+  last_settings = data;
+  begin(JournalEventType::settings);
+  stream << data;
+}
+
+bool Journal::read(QString file_name, QVector<JournalEvent>* events) {
+  QFile input(file_name);
+  if (!input.open(QIODevice::ReadOnly)) {
+    qWarning() << "Journal cannot be read:" << input.errorString();
+    return false;
+  }
+
+  QDataStream in(&input);
+  in.setVersion(STREAM_VERSION);
+  quint32 magic;
+  quint16 version;
+  in >> magic >> version;
+  if (magic != MAGIC || version != VERSION) {
+    qWarning() << "Not a journal of a supported version:" << file_name;
+    return false;
+  }
+
+  events->clear();
+  while (!in.atEnd()) {
+    JournalEvent event;
+    quint8 type;
+    quint32 time;
+    in >> type >> time;
+    event.type = JournalEventType(type);
+    event.time = time;
+
+    switch (event.type) {
+      case JournalEventType::settings: {
+        QByteArray data;
+        in >> data;
+        if (!deserialize(data, &event.settings))
+          in.setStatus(QDataStream::ReadCorruptData);
+      } break;
+
+      case JournalEventType::press: {
+        qint32 x, y;
+        in >> x >> y;
+        event.points = {QPoint(x, y)};
+      } break;
+
+      case JournalEventType::operation: {
+        quint8 operation;
+        in >> operation;
+        if (operation >= OPERATION_COUNT)
+          in.setStatus(QDataStream::ReadCorruptData);
+        event.operation = Operation(operation);
+      } break;
+
+      case JournalEventType::setup_draw:
+      case JournalEventType::undo:
+      case JournalEventType::redo:
+        break;
+
+      case JournalEventType::stroke:
+        in >> event.points;
+        break;
+
+      case JournalEventType::load:
+        in >> event.file_name >> event.clip;
+        break;
+
+      case JournalEventType::clear:
+        in >> event.color;
+        break;
+
+      case JournalEventType::resize: {
+        qint32 width, height;
+        in >> width >> height;
+        event.size = QSize(width, height);
+      } break;
+
+      case JournalEventType::tiled:
+        in >> event.tiled;
+        break;
+
+      default:
+        in.setStatus(QDataStream::ReadCorruptData);
+        break;
+    }
+
+    if (in.status() != QDataStream::Ok) {
+      qWarning() << "Journal is corrupted after" << events->size()
+                 << "events:" << file_name;
+      return false;
+    }
+    events->push_back(event);
+  }
+
+  return true;
+}
+
+QString Journal::name(const JournalEvent& event, Mode mode) {
+  switch (event.type) {
+    case JournalEventType::settings:
+      return "settings";
+    case JournalEventType::press:
+      return QString("press (%1)").arg(MODE_NAMES[int(mode)]);
+    case JournalEventType::operation:
+      return QString("operation (%1)")
+          .arg(OPERATION_NAMES[int(event.operation)]);
+    case JournalEventType::setup_draw:
+      return QString("setup draw (%1)").arg(MODE_NAMES[int(mode)]);
+    case JournalEventType::stroke:
+      return "stroke";
+    case JournalEventType::load:
+      return "load";
+    case JournalEventType::clear:
+      return "clear";
+    case JournalEventType::resize:
+      return "resize";
+    case JournalEventType::tiled:
+      return "tiled";
+    case JournalEventType::undo:
+      return "undo";
+    case JournalEventType::redo:
+      return "redo";
+  }
+
+  return "unknown";
+}
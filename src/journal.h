@@ -0,0 +1,73 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QtWidgets>
+#include "settings.h"
+
+enum class JournalEventType : quint8 {
+  settings,
+  press,
+  operation,
+  setup_draw,
+  stroke,
+  load,
+  clear,
+  resize,
+  tiled,
+  undo,
+  redo
+};
+
+struct JournalEvent {
+  JournalEventType type;
+  qint64 time;  // in ms since the start of recording
+  Settings settings;
+  QVector<QPoint> points;  // a single one for presses
+  Operation operation;
+  QString file_name;
+  QRect clip;  // of loaded files, empty for whole ones
+  QColor color;
+  QSize size;
+  bool tiled;
+};
+
+// Records what a user did on the canvas, with times, so that sessions can be
+// replayed as benchmarks. Each event is a type byte, a 32 bit time and its
+// arguments written with QDataStream; settings are written only when they
+// changed since the previous event, and only those affecting drawing.
+class Journal {
+ public:
+  bool start(QString file_name, const Settings& settings);
+  void stop();
+  bool isRecording() const;
+  // events are not recorded while suspended (replaying into the canvas)
+  void suspend(bool _suspended);
+
+  // settings are the ones the event happens with
+  void recordPress(const Settings& settings, QPoint point);
+  void recordOperation(const Settings& settings, Operation operation);
+  void recordSetupDraw(const Settings& settings);
+  void recordStroke(const Settings& settings, const QVector<QPoint>& points);
+  void recordLoad(QString file_name, QRect clip);
+  void recordClear(QColor color);
+  void recordResize(int width, int height);
+  void recordTiled(bool tiled);
+  void recordUndo();
+  void recordRedo();
+
+  static bool read(QString file_name, QVector<JournalEvent>* events);
+  // `mode` is the one of the canvas when the event is replayed
+  static QString name(const JournalEvent& event, Mode mode);
+
+ private:
+  QFile file;
+  QDataStream stream;
+  QElapsedTimer timer;
+  QByteArray last_settings;  // as written
+  bool suspended = false;
+
+  void begin(JournalEventType type);
+  void writeSettings(const Settings& settings);
+};
+
+#endif  // JOURNAL_H
@@ -1,10 +1,34 @@
 #include <QApplication>
 #include <QDebug>
 #include <QDesktopWidget>
+#include "batch.h"
 #include "mainwindow.h"
 
 int main(int argc, char* argv[]) {
   srand((unsigned int)time(NULL));
+
+  // batch mode needs no display, so it runs without QApplication
+  if (argc > 1 && QString(argv[1]) == "--batch") {
+    QCoreApplication a(argc, argv);
+    return Batch::main(a.arguments());
+  }
+
+  // replays run on a canvas that is never shown
+  if (argc > 1 && QString(argv[1]) == "--replay") {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+      qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication a(argc, argv);
+    const QStringList arguments = a.arguments();
+    if (arguments.size() < 3 || arguments.size() > 4 ||
+        (arguments.size() == 4 && arguments[3] != "--paced")) {
+      qWarning() << "Usage:" << arguments[0] << "--replay <journal> [--paced]";
+      return 2;
+    }
+
+    Canvas canvas;
+    return canvas.replayJournal(arguments[2], arguments.size() == 4) ? 0 : 1;
+  }
+
   // Exactly one application is needed for each program, no matter how many
   // windows are displayed. QApplication is used with all GUI apps.
   QApplication a(argc, argv);
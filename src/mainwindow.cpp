@@ -35,12 +35,45 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent) {
   //  statusBar()->addPermanentWidget(perm_label, 0);
   perm_label = new QLabel(tr("Press Space or RBM to draw shape"));
 
+  // shown while any picture is being encoded
+  save_progress = new QProgressBar;
+  save_progress->setRange(0, 0);
+  save_progress->setMaximumWidth(150);
+  save_progress->hide();
+  statusBar()->addPermanentWidget(save_progress);
+  connect(canvas, &Canvas::saveStarted, this, [this](QString file_name) {
+    ++saves_running;
+    save_progress->show();
+    statusBar()->showMessage(tr("Saving %1...").arg(file_name));
+  });
+  connect(canvas, &Canvas::saveFinished, this,
+          [this](QString file_name, bool successful) {
+            if (--saves_running == 0) save_progress->hide();
+            statusBar()->showMessage(
+                successful ? tr("Saved %1").arg(file_name)
+                           : tr("Saving %1 failed").arg(file_name),
+                5000);
+          });
+
   setWindowTitle(tr("Marek \u0141uszczki OpenGL"));
   setMinimumSize(200, 200);
   resize(900, 900);
 
   connect(canvas, SIGNAL(changedSetupMode(bool)), this,
           SLOT(setContextMenu(bool)));
+
+  // asked once the window is shown
+  if (canvas->startAutosave())
+    QTimer::singleShot(0, this, [this]() {
+      const QMessageBox::StandardButton answer = QMessageBox::question(
+          this, tr("Recover picture"),
+          tr("The previous session did not end normally. Recover the picture "
+             "it autosaved?"));
+      if (answer == QMessageBox::Yes)
+        canvas->recover();
+      else
+        canvas->discardRecovery();
+    });
 }
 
 void MainWindow::createActions() {
@@ -53,11 +86,29 @@ void MainWindow::createActions() {
   load_file_act->setStatusTip(tr("Load a file to canvas"));
   connect(load_file_act, &QAction::triggered, this, &MainWindow::loadFile);
 
+  load_part_act = new QAction(tr("Load &part"), this);
+  load_part_act->setStatusTip(
+      tr("Load only a rectangle of a file, for pictures too big to open"));
+  connect(load_part_act, &QAction::triggered, this, &MainWindow::loadPart);
+
   save_file_act = new QAction(tr("&Save"), this);
   save_file_act->setShortcut(QKeySequence::Save);
   save_file_act->setStatusTip(tr("Save image to a file"));
   connect(save_file_act, &QAction::triggered, this, &MainWindow::saveFile);
 
+  record_journal_act = new QAction(tr("Record &journal"), this);
+  record_journal_act->setCheckable(true);
+  record_journal_act->setStatusTip(
+      tr("Record clicks, operations and settings to replay them later"));
+  connect(record_journal_act, &QAction::triggered, this,
+          &MainWindow::recordJournal);
+
+  replay_journal_act = new QAction(tr("Re&play journal"), this);
+  replay_journal_act->setStatusTip(
+      tr("Replay a recorded journal and print times of its operations"));
+  connect(replay_journal_act, &QAction::triggered, this,
+          &MainWindow::replayJournal);
+
   quit_act = new QAction(tr("&Quit"), this);
   quit_act->setShortcut(QKeySequence::Quit);
   quit_act->setStatusTip(tr("Remember to save your work before quitting"));
@@ -71,6 +122,24 @@ void MainWindow::createActions() {
   mode_click_act->setStatusTip(tr("Default, simple click mode"));
   connect(mode_click_act, &QAction::triggered, this, &MainWindow::modeClick);
 
+  mode_stroke_act = new QAction(tr("Stro&ke"), this);
+  mode_stroke_act->setCheckable(true);
+  mode_stroke_act->setShortcut(QKeySequence(tr("W")));
+  mode_stroke_act->setStatusTip(
+      tr("Freehand strokes drawn with continuous lines of current type"));
+  connect(mode_stroke_act, &QAction::triggered, this,
+          &MainWindow::modeStroke);
+
+  undo_act = new QAction(tr("&Undo"), this);
+  undo_act->setShortcut(QKeySequence::Undo);
+  undo_act->setStatusTip(tr("Undo the last change of the canvas"));
+  connect(undo_act, &QAction::triggered, this, [&]() { canvas->undo(); });
+
+  redo_act = new QAction(tr("Red&o"), this);
+  redo_act->setShortcut(QKeySequence::Redo);
+  redo_act->setStatusTip(tr("Redo the last undone change of the canvas"));
+  connect(redo_act, &QAction::triggered, this, [&]() { canvas->redo(); });
+
   clear_canvas_act = new QAction(tr("Clea&r canvas"), this);
   clear_canvas_act->setShortcut(QKeySequence(tr("Y")));
   clear_canvas_act->setStatusTip(tr("Set canvas color to white"));
@@ -92,6 +161,14 @@ void MainWindow::createActions() {
       tr("Enable grid for alignment debugging purposes"));
   connect(switch_grid_act, &QAction::triggered, this, &MainWindow::switchGrid);
 
+  switch_tiled_act = new QAction(tr("&Tiled canvas"), this);
+  switch_tiled_act->setCheckable(true);
+  switch_tiled_act->setShortcut(QKeySequence(tr("M")));
+  switch_tiled_act->setStatusTip(
+      tr("Keep pixels in lazily allocated tiles (no transformations)"));
+  connect(switch_tiled_act, &QAction::triggered, this,
+          &MainWindow::switchTiled);
+
   change_scale_act = new QAction(tr("&Zoom"));
   change_scale_act->setShortcut(QKeySequence(tr("Z")));
   change_scale_act->setStatusTip(
@@ -227,6 +304,7 @@ void MainWindow::createActions() {
 
   mode_group = new QActionGroup(this);
   mode_group->addAction(mode_click_act);
+  mode_group->addAction(mode_stroke_act);
   mode_group->addAction(mode_line_act);
   mode_group->addAction(mode_polygon_act);
   mode_group->addAction(mode_circle_act);
@@ -243,16 +321,24 @@ void MainWindow::createMenus() {
   file_menu = menuBar()->addMenu(tr("&File"));
   file_menu->menuAction()->setStatusTip(tr("File operations"));
   file_menu->addAction(load_file_act);
+  file_menu->addAction(load_part_act);
   file_menu->addAction(save_file_act);
   file_menu->addSeparator();
+  file_menu->addAction(record_journal_act);
+  file_menu->addAction(replay_journal_act);
+  file_menu->addSeparator();
   file_menu->addAction(quit_act);
 
   general_menu = menuBar()->addMenu(tr("&General"));
   general_menu->menuAction()->setStatusTip(tr("Core functionalities"));
   general_menu->addAction(mode_click_act);
+  general_menu->addAction(mode_stroke_act);
+  general_menu->addAction(undo_act);
+  general_menu->addAction(redo_act);
   general_menu->addAction(clear_canvas_act);
   general_menu->addAction(switch_debug_act);
   general_menu->addAction(switch_grid_act);
+  general_menu->addAction(switch_tiled_act);
   general_menu->addAction(change_scale_act);
   general_menu->addSeparator();
   general_menu->addAction(settings_general_act);
@@ -329,13 +415,53 @@ void MainWindow::quit() { QApplication::quit(); }
 
 void MainWindow::loadFile() {
   QString file_name = QFileDialog::getOpenFileName(
-      this, tr("Choose image to open"), "..", tr("Images (*.png *.bmp *.jpg)"));
+      this, tr("Choose image to open"), "..",
+      tr("Images (*.png *.bmp *.jpg *.qraw)"));
   if (!file_name.isEmpty())
     canvas->loadFile(file_name);
   else
     qWarning() << tr("File has not been chosen");
 }
 
+// size is read from the header of the file, which is not decoded here
+void MainWindow::loadPart() {
+  QString file_name = QFileDialog::getOpenFileName(
+      this, tr("Choose image to open a part of"), "..",
+      tr("Images (*.png *.bmp *.jpg *.qraw)"));
+  if (file_name.isEmpty()) {
+    qWarning() << tr("File has not been chosen");
+    return;
+  }
+  QSize size = QImageReader(file_name).size();
+  if (!size.isValid()) size = QSize(65536, 65536);
+
+  QDialog dialog(this);
+  dialog.setWindowTitle(tr("Load part"));
+  QFormLayout form(&dialog);
+
+  Inputs corner(tr("Top left corner: "));
+  corner.addLabel(tr("X: "));
+  corner.addIntInput(0, 0, size.width() - 1);
+  corner.addLabel(tr("Y: "));
+  corner.addIntInput(0, 0, size.height() - 1);
+  form.addWidget(&corner);
+
+  Inputs part_size(tr("Size of the part: "));
+  part_size.addLabel(tr("Width: "));
+  part_size.addIntInput(1, qMin(size.width(), 4096), size.width());
+  part_size.addLabel(tr("Height: "));
+  part_size.addIntInput(1, qMin(size.height(), 4096), size.height());
+  form.addWidget(&part_size);
+
+  form.addWidget(new DialogStandardButtons(&dialog));
+
+  if (dialog.exec() == QDialog::Accepted)
+    canvas->loadFile(file_name, QRect(corner.ints[0]->value(),
+                                      corner.ints[1]->value(),
+                                      part_size.ints[0]->value(),
+                                      part_size.ints[1]->value()));
+}
+
 void MainWindow::saveFile() {
   // create a dialog in parent
   QFileDialog dialog(this);
@@ -363,7 +489,65 @@ void MainWindow::saveFile() {
     qWarning() << tr("Save location has not been chosen correctly");
 }
 
+void MainWindow::recordJournal() {
+  if (canvas->isRecordingJournal()) {
+    canvas->stopJournal();
+  } else {
+    QString file_name = QFileDialog::getSaveFileName(
+        this, tr("Choose journal file"), "..", tr("Journals (*.journal)"));
+    if (file_name.isEmpty())
+      qWarning() << tr("Journal location has not been chosen");
+    else
+      canvas->startJournal(file_name);
+  }
+
+  record_journal_act->setChecked(canvas->isRecordingJournal());
+}
+
+void MainWindow::replayJournal() {
+  QString file_name = QFileDialog::getOpenFileName(
+      this, tr("Choose journal to replay"), "..", tr("Journals (*.journal)"));
+  if (file_name.isEmpty()) {
+    qWarning() << tr("File has not been chosen");
+    return;
+  }
+
+  const bool paced =
+      QMessageBox::question(this, tr("Replay journal"),
+                            tr("Keep original times between operations?")) ==
+      QMessageBox::Yes;
+
+  // replays run in a process of their own (see --replay), so the picture
+  // being edited and this window stay untouched; results are printed to the
+  // same output
+  QStringList arguments = {"--replay", file_name};
+  if (paced) arguments << "--paced";
+  QProcess* replay = new QProcess(this);
+  replay->setProcessChannelMode(QProcess::ForwardedChannels);
+  connect(replay,
+          static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(
+              &QProcess::finished),
+          this, [this, replay](int exit_code) {
+            replay_journal_act->setEnabled(true);
+            statusBar()->showMessage(exit_code == 0
+                                         ? tr("Journal replayed")
+                                         : tr("Journal replay failed"));
+            replay->deleteLater();
+          });
+  connect(replay, &QProcess::errorOccurred, this,
+          [this, replay](QProcess::ProcessError error) {
+            if (error != QProcess::FailedToStart) return;
+            replay_journal_act->setEnabled(true);
+            statusBar()->showMessage(tr("Journal replay failed"));
+            replay->deleteLater();
+          });
+  replay_journal_act->setEnabled(false);
+  statusBar()->showMessage(tr("Replaying journal"));
+  replay->start(QCoreApplication::applicationFilePath(), arguments);
+}
+
 void MainWindow::modeClick() { canvas->setMode(Mode::click); }
+void MainWindow::modeStroke() { canvas->setMode(Mode::stroke); }
 
 void MainWindow::switchDebug() {
   debug = !debug;
@@ -372,6 +556,10 @@ void MainWindow::switchDebug() {
 
 void MainWindow::switchGrid() { canvas->switchGrid(); }
 
+void MainWindow::switchTiled() {
+  canvas->setTiled(!canvas->settings.tiled);
+}
+
 void MainWindow::changeScale() {
   QDialog dialog(this);
   dialog.setWindowTitle(tr("Set display zoom"));
@@ -398,13 +586,6 @@ void MainWindow::changeScale() {
         QString::number(zoom_slider.value() * 1.0 / multiplier, 'g', 2));
   });
 
-  QLabel warning_label(
-      tr("High zoom levels will severely degrade performance. Use for "
-         "debugging purposes only."));
-  warning_label.setWordWrap(true);
-  form.addWidget(&warning_label);
-
-
   form.addWidget(new DialogStandardButtons(&dialog));
 
   if (dialog.exec() == QDialog::Accepted) {
@@ -430,11 +611,67 @@ void MainWindow::settingsGeneral() {
 
   form.addWidget(&debug_widget);
 
+  // tiled canvases allocate only painted tiles, so they can be much bigger
+  Inputs size(tr("Canvas size (picture is cropped or extended with white): "));
+  size.addLabel(tr("Width: "));
+  size.addIntInput(1, canvas->settings.width, 262144);
+  size.addLabel(tr("Height: "));
+  size.addIntInput(1, canvas->settings.height, 262144);
+  size.addCheckbox(tr("Tiled (memory only for painted parts, no "
+                      "transformations)"),
+                   canvas->settings.tiled);
+  form.addWidget(&size);
+
+  Inputs threshold(tr("Show progress of operations running longer than: "));
+  threshold.addLabel(tr("ms: "));
+  threshold.addIntInput(0, canvas->settings.progress_threshold, 60000);
+  form.addWidget(&threshold);
+
+  Inputs frame_rate(tr("Repaint the canvas at most: "));
+  frame_rate.addLabel(tr("times per second: "));
+  frame_rate.addIntInput(1, canvas->settings.frame_rate, 240);
+  form.addWidget(&frame_rate);
+
+  Inputs undo(tr("Memory for undo history (0 disables it): "));
+  undo.addLabel(tr("MB: "));
+  undo.addIntInput(0, canvas->settings.undo_budget, 65536);
+  undo.addCheckbox(tr("Compress saved tiles (less memory, slower drawing)"),
+                   canvas->settings.undo_compression);
+  form.addWidget(&undo);
+
+  Inputs autosave(tr("Autosave changed parts of the picture every (0 disables "
+                     "it): "));
+  autosave.addLabel(tr("s: "));
+  autosave.addIntInput(0, canvas->settings.autosave_interval, 3600);
+  form.addWidget(&autosave);
+
+  Inputs quality(tr("Quality of saved pictures (lower compresses more, -1 "
+                    "uses the default of a format): "));
+  quality.addLabel(tr("Quality: "));
+  quality.addIntInput(-1, canvas->settings.save_quality, 100);
+  form.addWidget(&quality);
 
   form.addWidget(new DialogStandardButtons(&dialog));
 
   if (dialog.exec() == QDialog::Accepted) {
     canvas->setDebugColor(debug_color);
+    canvas->setProgressThreshold(threshold.ints[0]->value());
+    canvas->setFrameRate(frame_rate.ints[0]->value());
+    canvas->setUndoHistory(undo.ints[0]->value(),
+                           undo.checkboxes[0]->isChecked());
+    canvas->setAutosaveInterval(autosave.ints[0]->value());
+    canvas->setSaveQuality(quality.ints[0]->value());
+
+    // switching to tiles first resizes the tiled store, so a big canvas is
+    // never allocated densely
+    const bool tiled = size.checkboxes[0]->isChecked();
+    if (tiled && !canvas->settings.tiled) canvas->setTiled(true);
+    const int width = size.ints[0]->value();
+    const int height = size.ints[1]->value();
+    if (width != canvas->settings.width || height != canvas->settings.height)
+      canvas->setCanvasSize(width, height);
+    if (!tiled && canvas->settings.tiled) canvas->setTiled(false);
+    switch_tiled_act->setChecked(tiled);
   }
 }
 
@@ -637,6 +874,14 @@ void MainWindow::settingsTr() {
                      canvas->settings.rotate_inplace);
 
   form.addWidget(&rotate);
+
+  ButtonBox<RotationType, QHBoxLayout> rotation(
+      tr("Rotation function: "), canvas->settings.rotation_type);
+  rotation.addButton(tr("Matrix (2D resampling)"), RotationType::matrix);
+  rotation.addButton(tr("Three shears (1D resampling)"), RotationType::shears);
+  rotation.initializeChecked();
+
+  form.addWidget(&rotation);
   form.addWidget(new Separator());
 
   // SCALE
@@ -676,6 +921,22 @@ void MainWindow::settingsTr() {
 
   form.addWidget(&interpolation);
 
+  // TRAVERSAL
+  Inputs tiling(tr("Destination tile size (0 walks the image row by row): "));
+  tiling.addLabel(tr("Tile: "));
+  tiling.addIntInput(0, canvas->settings.transform_tile_size, 1024);
+  tiling.addCheckbox(tr("Prefetch source pixels of the next tile"),
+                     canvas->settings.transform_prefetch);
+
+  form.addWidget(&tiling);
+
+  Inputs cache(
+      tr("Memory for maps of repeated transformations (0 disables): "));
+  cache.addLabel(tr("MB: "));
+  cache.addIntInput(0, canvas->settings.transform_cache_size, 1024);
+
+  form.addWidget(&cache);
+
 
   form.addRow(new DialogStandardButtons(&dialog));
 
@@ -683,11 +944,15 @@ void MainWindow::settingsTr() {
     canvas->setShift(shift.ints[0]->value(), shift.ints[1]->value());
     canvas->setRotate(rotate.doubles[0]->value(),
                       rotate.checkboxes[0]->isChecked());
+    canvas->setRotationType(rotation.selectedType());
     canvas->setScale(scale.doubles[0]->value(), scale.doubles[1]->value(),
                      scale.checkboxes[0]->isChecked());
     canvas->setShear(shear.doubles[0]->value(), shear.doubles[1]->value(),
                      shear.checkboxes[0]->isChecked());
     canvas->setInterpolationType(interpolation.selectedType());
+    canvas->setTransformTiling(tiling.ints[0]->value(),
+                               tiling.checkboxes[0]->isChecked());
+    canvas->setTransformCache(cache.ints[0]->value());
   }
 }
 
@@ -22,12 +22,17 @@ class MainWindow : public QMainWindow {
 
   /*  MENU SLOTS  */
   void loadFile();
+  void loadPart();
   void saveFile();
+  void recordJournal();
+  void replayJournal();
   void quit();
 
   void modeClick();
+  void modeStroke();
   void switchDebug();
   void switchGrid();
+  void switchTiled();
   void changeScale();
   void settingsGeneral();
 
@@ -56,6 +61,8 @@ class MainWindow : public QMainWindow {
   bool debug = false;
   bool setup = false;
   QLabel* perm_label;
+  QProgressBar* save_progress;
+  int saves_running = 0;
 
   void createActions();
   void createMenus();
@@ -71,13 +78,20 @@ class MainWindow : public QMainWindow {
   QActionGroup* mode_group;
 
   QAction* load_file_act;
+  QAction* load_part_act;
   QAction* save_file_act;
+  QAction* record_journal_act;
+  QAction* replay_journal_act;
   QAction* quit_act;
 
   QAction* mode_click_act;
+  QAction* mode_stroke_act;
+  QAction* undo_act;
+  QAction* redo_act;
   QAction* clear_canvas_act;
   QAction* switch_debug_act;
   QAction* switch_grid_act;
+  QAction* switch_tiled_act;
   QAction* change_scale_act;
   QAction* settings_general_act;
 
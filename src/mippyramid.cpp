@@ -0,0 +1,108 @@
+#include "mippyramid.h"
+
+MipPyramid::MipPyramid() {}
+MipPyramid::MipPyramid(const QImage* _image) { setImage(_image); }
+
+void MipPyramid::setImage(const QImage* _image) {
+  image = _image;
+  levels.clear();
+  dirty.clear();
+}
+
+// levels keep their memory, they are only recomputed
+void MipPyramid::invalidate() {
+  for (int n = 1; n <= levels.size(); ++n) dirty[n - 1] = levels[n - 1].rect();
+}
+
+// `rect` is in coordinates of the image
+void MipPyramid::invalidate(QRect rect) {
+  rect &= image->rect();
+  if (rect.isEmpty()) return;
+
+  // pixel x of level n is computed from pixels [x * 2^n, (x + 1) * 2^n) of
+  // the image
+  for (int n = 1; n <= dirty.size(); ++n) {
+    dirty[n - 1] += QRect(QPoint(rect.left() >> n, rect.top() >> n),
+                          QPoint(rect.right() >> n, rect.bottom() >> n));
+  }
+}
+
+int MipPyramid::levelCount() const {
+  int count = 1;
+  for (int w = image->width(), h = image->height(); w > 1 || h > 1; ++count) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+
+  return count;
+}
+
+// level that is at most `footprint` times smaller than the image
+int MipPyramid::levelFor(qreal footprint) const {
+  const int count = levelCount();
+  int n = 0;
+  while (n + 1 < count && (2 << n) <= footprint) ++n;
+
+  return n;
+}
+
+const QImage& MipPyramid::level(int n) {
+  if (n <= 0) return *image;
+
+  // image changed its dimensions, build everything again
+  const QSize first((image->width() + 1) / 2, (image->height() + 1) / 2);
+  if (!levels.isEmpty() && levels[0].size() != first) setImage(image);
+
+  if (levels.isEmpty()) {
+    levels.resize(levelCount() - 1);
+    dirty.resize(levels.size());
+  }
+  n = qMin(n, levels.size());
+
+  for (int k = 1; k <= n; ++k) {
+    if (levels[k - 1].isNull()) {
+      const QImage& previous = k == 1 ? *image : levels[k - 2];
+      levels[k - 1] = QImage((previous.width() + 1) / 2,
+                             (previous.height() + 1) / 2,
+                             QImage::Format_ARGB32);
+      dirty[k - 1] = levels[k - 1].rect();
+    }
+
+    for (const QRect& rect : dirty[k - 1]) downsample(k, rect);
+    dirty[k - 1] = QRegion();
+  }
+
+  return levels[n - 1];
+}
+
+// averages 2x2 blocks of level n - 1 into `rect` of level n
+void MipPyramid::downsample(int n, QRect rect) {
+  const QImage& source = n == 1 ? *image : levels[n - 2];
+  QImage& destination = levels[n - 1];
+  rect &= destination.rect();
+
+  const int last_x = source.width() - 1;
+  const int last_y = source.height() - 1;
+
+  for (int y = rect.top(); y <= rect.bottom(); ++y) {
+    const QRgb* top = (const QRgb*)source.constScanLine(2 * y);
+    const QRgb* bottom =
+        (const QRgb*)source.constScanLine(qMin(2 * y + 1, last_y));
+    QRgb* line = (QRgb*)destination.scanLine(y);
+
+    for (int x = rect.left(); x <= rect.right(); ++x) {
+      const int x0 = 2 * x;
+      const int x1 = qMin(2 * x + 1, last_x);
+      const QRgb p[4] = {top[x0], top[x1], bottom[x0], bottom[x1]};
+
+      int red = 2, green = 2, blue = 2, alpha = 2;  // rounding
+      for (QRgb c : p) {
+        red += qRed(c);
+        green += qGreen(c);
+        blue += qBlue(c);
+        alpha += qAlpha(c);
+      }
+      line[x] = qRgba(red / 4, green / 4, blue / 4, alpha / 4);
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef MIPPYRAMID_H
+#define MIPPYRAMID_H
+
+#include <QtWidgets>
+
+// Lazily built copies of an image, each with half resolution of the previous
+// one. Level 0 is the image itself, level n is 2^n times smaller. Only parts
+// marked with invalidate() are recomputed when a level is requested again.
+class MipPyramid {
+ public:
+  MipPyramid();
+  MipPyramid(const QImage* _image);
+
+  void setImage(const QImage* _image);
+  void invalidate();
+  void invalidate(QRect rect);
+
+  int levelCount() const;
+  int levelFor(qreal footprint) const;
+  const QImage& level(int n);
+
+ private:
+  const QImage* image = nullptr;
+
+  QVector<QImage> levels;  // levels[n - 1] holds level n
+  QVector<QRegion> dirty;  // areas to recompute, in coordinates of a level
+
+  void downsample(int n, QRect rect);
+};
+
+#endif  // MIPPYRAMID_H
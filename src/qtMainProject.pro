@@ -6,7 +6,7 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = qtMainProject
 TEMPLATE = app
@@ -28,14 +28,34 @@ SOURCES += main.cpp\
     canvas.cpp \
     drawer.cpp \
     debugwindow.cpp \
-    uihelpers.cpp
+    uihelpers.cpp \
+    mippyramid.cpp \
+    tiledimage.cpp \
+    renderthread.cpp \
+    repaintscheduler.cpp \
+    steptrace.cpp \
+    batch.cpp \
+    journal.cpp \
+    undohistory.cpp \
+    autosave.cpp \
+    rawimage.cpp
 
 HEADERS  += mainwindow.h \
     canvas.h \
     drawer.h \
     debugwindow.h \
     uihelpers.h \
-    settings.h
+    settings.h \
+    mippyramid.h \
+    tiledimage.h \
+    renderthread.h \
+    repaintscheduler.h \
+    steptrace.h \
+    batch.h \
+    journal.h \
+    undohistory.h \
+    autosave.h \
+    rawimage.h
 
 CONFIG += mobility
 MOBILITY = 
@@ -0,0 +1,117 @@
+#include "rawimage.h"
+#include <cstring>
+#include "drawer.h"
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static const quint32 MAGIC = 0x514d5052;  // "QMPR"
+static const quint16 VERSION = 1;
+
+const QString RawImage::SUFFIX = "qraw";
+
+RawImage::RawImage() {}
+
+RawImage::~RawImage() {
+  if (data != nullptr) file.unmap(data);
+}
+
+bool RawImage::isRawFile(QString file_name) {
+  return QFileInfo(file_name).suffix().toLower() == SUFFIX;
+}
+
+// rows of the file are aligned like rows of the working format
+bool RawImage::write(QString file_name, const QImage& image) {
+  const QImage source = image.format() == QImage::Format_ARGB32
+                            ? image
+                            : image.convertToFormat(QImage::Format_ARGB32);
+  const int row_bytes = source.width() * sizeof(QRgb);
+  const int bytes_per_line =
+      (row_bytes + Drawer::ROW_ALIGNMENT - 1) / Drawer::ROW_ALIGNMENT *
+      Drawer::ROW_ALIGNMENT;
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  header.magic = MAGIC;
+  header.version = VERSION;
+  header.layout = 0;
+  header.width = source.width();
+  header.height = source.height();
+  header.bytes_per_line = bytes_per_line;
+  header.offset = HEADER_SIZE;
+
+  QSaveFile output(file_name);
+  if (!output.open(QIODevice::WriteOnly)) return false;
+
+  QByteArray head(HEADER_SIZE, 0);
+  memcpy(head.data(), &header, sizeof(header));
+  output.write(head);
+  QByteArray row(bytes_per_line, 0);
+  for (int y = 0; y < source.height(); ++y) {
+    memcpy(row.data(), source.constScanLine(y), row_bytes);
+    output.write(row);
+  }
+
+  return output.commit();
+}
+
+bool RawImage::open(QString file_name, bool writable) {
+  file.setFileName(file_name);
+  if (!file.open(writable ? QIODevice::ReadWrite : QIODevice::ReadOnly)) {
+    qWarning() << "Raw image cannot be opened:" << file.errorString();
+    return false;
+  }
+
+  size = file.size();
+  if (size < HEADER_SIZE ||
+      file.read((char*)&header, sizeof(header)) != sizeof(header) ||
+      header.magic != MAGIC || header.version != VERSION ||
+      header.layout != 0 || header.width == 0 || header.height == 0 ||
+      header.bytes_per_line < header.width * sizeof(QRgb) ||
+      header.bytes_per_line % sizeof(QRgb) != 0 ||
+      header.offset % sizeof(QRgb) != 0 ||
+      header.offset + qint64(header.bytes_per_line) * header.height > size) {
+    qWarning() << "Not a raw image of a supported version:" << file_name;
+    file.close();
+    return false;
+  }
+
+  // mapping starts on a page boundary, as msync needs
+  data = file.map(0, size);
+  if (data == nullptr) {
+    qWarning() << "Raw image cannot be mapped:" << file.errorString();
+    file.close();
+    return false;
+  }
+
+  return true;
+}
+
+QString RawImage::fileName() const {
+  return QFileInfo(file.fileName()).absoluteFilePath();
+}
+
+QImage RawImage::image() const {
+  if (data == nullptr) return QImage();
+
+  // read only pages are given as const, so writing copies them first
+  if (!file.isWritable())
+    return QImage((const uchar*)data + header.offset, header.width,
+                  header.height, header.bytes_per_line, QImage::Format_ARGB32);
+
+  return QImage(data + header.offset, header.width, header.height,
+                header.bytes_per_line, QImage::Format_ARGB32);
+}
+
+// the kernel writes back only pages which have been changed
+bool RawImage::sync() {
+  if (data == nullptr) return false;
+
+#ifdef Q_OS_WIN
+  return FlushViewOfFile(data, size) && file.flush();
+#else
+  return msync(data, size, MS_SYNC) == 0;
+#endif
+}
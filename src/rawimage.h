@@ -0,0 +1,47 @@
+#ifndef RAWIMAGE_H
+#define RAWIMAGE_H
+
+#include <QtWidgets>
+
+// Native uncompressed canvas file: a 64 byte header followed by ARGB32 rows
+// padded to Drawer::ROW_ALIGNMENT. An opened file is mapped into memory and
+// its image works directly on the mapped pages, so opening takes no time and
+// drawing changes the file itself; saving only flushes pages changed since
+// (msync). The header has a layout field for other arrangements of pixels,
+// only rows are written so far.
+class RawImage {
+ public:
+  static const QString SUFFIX;
+  static const int HEADER_SIZE = 64;
+
+  RawImage();
+  ~RawImage();  // the image must not be used afterwards
+
+  static bool isRawFile(QString file_name);
+  static bool write(QString file_name, const QImage& image);
+
+  // a read only file is mapped read only, its image must then be copied
+  // before drawing on it
+  bool open(QString file_name, bool writable = true);
+  QString fileName() const;
+  QImage image() const;  // over the mapped rows, it does not own them
+  bool sync();
+
+ private:
+  struct Header {
+    quint32 magic;
+    quint16 version;
+    quint16 layout;  // 0 = rows
+    quint32 width;
+    quint32 height;
+    quint32 bytes_per_line;
+    quint32 offset;  // of the first row
+  };
+
+  QFile file;
+  uchar* data = nullptr;
+  qint64 size = 0;
+  Header header;
+};
+
+#endif  // RAWIMAGE_H
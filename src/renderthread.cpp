@@ -0,0 +1,493 @@
+#include "renderthread.h"
+#include <cstring>
+#include "autosave.h"
+
+RenderThread::RenderThread(QObject* parent) : QThread(parent) {
+  mipmaps.setImage(&image);
+
+  drawer.setImage(&image);
+  drawer.setMipmaps(&mipmaps);
+  drawer.setHistory(&history);
+  drawer.setProgressCallback(
+      [this](int done, int total) { return progress(done, total); });
+}
+
+RenderThread::~RenderThread() {
+  {
+    QMutexLocker locker(&queue_mutex);
+    quitting = true;
+    queue.clear();
+  }
+  cancelled = true;
+  queue_changed.wakeAll();
+  wait();
+  saves.waitForFinished();
+}
+
+void RenderThread::submit(Command command, QString name, bool continues) {
+  QMutexLocker locker(&queue_mutex);
+  queue.enqueue({name, command, continues});
+  queue_changed.wakeAll();
+}
+
+void RenderThread::cancel() { cancelled = true; }
+
+RenderFrame RenderThread::takeFrame() {
+  QMutexLocker locker(&frame_mutex);
+  RenderFrame taken = frame;
+  frame = RenderFrame();
+
+  return taken;
+}
+
+void RenderThread::run() {
+  forever {
+    Queued queued;
+    {
+      QMutexLocker locker(&queue_mutex);
+      while (queue.isEmpty() && !quitting) queue_changed.wait(&queue_mutex);
+      if (quitting) return;
+
+      queued = queue.dequeue();
+      cancelled = false;
+    }
+    const QString name = queued.name;
+
+    emit commandStarted(name);
+    timer.start();
+    last_publish = 0;
+
+    // every command is a step of history, unless it changes nothing
+    if (tiled)
+      history.beginStep(&tiles, queued.continues);
+    else
+      history.beginStep(&image, queued.continues);
+    queued.command(drawer);
+    history.endStep();
+
+    publish();
+    emit commandFinished(name, cancelled);
+  }
+}
+
+// called by drawer from inside of long loops
+bool RenderThread::progress(int done, int total) {
+  if (cancelled) return false;
+
+  // partial results of operations working in place are shown as they go
+  const int interval = 100;  // in ms
+  if (timer.elapsed() - last_publish >= interval) {
+    last_publish = timer.elapsed();
+    emit progressChanged(total > 0 ? qMin(100, int(100LL * done / total)) : 0);
+    publish();
+  }
+
+  return true;
+}
+
+// hands pixels changed since the previous frame over to the GUI thread
+void RenderThread::publish() {
+  const QRegion changed = drawer.dirtyRegion() + replaced;
+  const QVector<StepTrace> traces = drawer.takeTraces();
+  if (changed.isEmpty() && traces.isEmpty()) return;
+  drawer.resetDirtyRegion();
+  replaced = QRegion();
+
+  if (!tiled)
+    for (const QRect& rect : changed) mipmaps.invalidate(rect);
+
+  {
+    QMutexLocker locker(&frame_mutex);
+    frame.size = canvasRect().size();
+    frame.tiled = tiled;
+    frame.preview = QImage();
+    for (const QRect& rect : changed) {
+      frame.rects.push_back(rect);
+      if (!tiled) frame.patches.push_back(image.copy(rect));
+    }
+    if (tiled) frame.tiles = tiles;  // only tiles written later get copied
+    frame.traces += traces;
+  }
+
+  emit frameReady();
+}
+
+// preview replaces everything not taken yet, so nothing is painted over it
+void RenderThread::publishPreview(const QImage& preview, QSize size) {
+  {
+    QMutexLocker locker(&frame_mutex);
+    frame = RenderFrame();
+    frame.size = size;
+    frame.preview = preview;
+  }
+
+  emit frameReady();
+}
+
+QRect RenderThread::canvasRect() const {
+  return tiled ? tiles.rect() : image.rect();
+}
+
+
+/*  ------------------------------------------------------------------------  */
+/*  COMMANDS REPLACING THE WHOLE CANVAS  */
+
+void RenderThread::loadFile(QString file_name, QRect clip) {
+  submit(
+      [this, file_name, clip](Drawer& drawer) {
+        if (!RawImage::isRawFile(file_name)) {
+          decodeFile(file_name, clip, drawer);
+          return;
+        }
+        // pixels of files which cannot be written are copied instead
+        if (!tiled && clip.isEmpty() && QFileInfo(file_name).isWritable()) {
+          mapFile(file_name, drawer);
+          return;
+        }
+
+        QImage loaded = readRawFile(file_name, clip);
+        if (loaded.isNull()) {
+          qWarning() << "Image has not been loaded successfully";
+          return;
+        }
+        replaceImage(std::move(loaded), drawer);
+      },
+      tr("Loading %1").arg(file_name));
+}
+
+void RenderThread::recoverFile(QString file_name) {
+  submit(
+      [this, file_name](Drawer& drawer) {
+        // the file is kept when recovery fails, so it can be tried again
+        TiledImage recovered = Autosave::recover(file_name);
+        if (recovered.isNull()) {
+          qWarning() << "Nothing could be recovered from" << file_name;
+          return;
+        }
+
+        // canvas becomes tiled when the picture does not fit into an image
+        QImage dense;
+        if (!tiled) {
+          dense = Drawer::toWorkingFormat(recovered.toImage());
+          if (dense.isNull()) {
+            qWarning() << "Recovered picture is too big for a single image, "
+                          "canvas becomes tiled";
+            tiled = true;
+            image = QImage();
+          }
+        }
+
+        history.clear();
+        if (tiled) {
+          tiles = recovered;
+          drawer.setTiledImage(&tiles);
+        } else {
+          image.swap(dense);
+          drawer.setImage(&image);
+        }
+        dense = QImage();  // may be over the mapped file released below
+        raw.reset();
+        drawer.resetDirtyRegion();
+        replaced = canvasRect();
+        QFile::remove(file_name);
+      },
+      tr("Recovering"));
+}
+
+// converted once here, so drawing never deals with other formats; images
+// already in the working format are taken over without a copy, as long as
+// the caller does not keep them. Drawer keeps its settings and cached
+// transformation maps
+void RenderThread::replaceImage(QImage loaded, Drawer& drawer) {
+  history.clear();
+  if (tiled) {
+    tiles = TiledImage(loaded);
+    drawer.setTiledImage(&tiles);
+  } else {
+    if (Drawer::isWorkingFormat(loaded))
+      image.swap(loaded);
+    else
+      image = Drawer::toWorkingFormat(loaded);
+    drawer.setImage(&image);
+  }
+  loaded = QImage();  // may be over the mapped file released below
+  raw.reset();
+  drawer.resetDirtyRegion();
+  replaced = canvasRect();
+}
+
+// pixels stay in the file, drawing writes straight to its mapped pages
+void RenderThread::mapFile(QString file_name, Drawer& drawer) {
+  RawImage* mapped = new RawImage();
+  if (!mapped->open(file_name)) {
+    delete mapped;
+    qWarning() << "Image has not been loaded successfully";
+    return;
+  }
+
+  history.clear();
+  image = mapped->image();
+  raw.reset(mapped);  // previous file is unmapped after its image is gone
+  drawer.setImage(&image, true);
+  drawer.resetDirtyRegion();
+  replaced = canvasRect();
+}
+
+// a field of /proc/self/status in kB, -1 where it is not known
+static qint64 memoryStatus(const QByteArray& field) {
+  QFile status("/proc/self/status");
+  if (!status.open(QIODevice::ReadOnly | QIODevice::Text)) return -1;
+  for (QByteArray line = status.readLine(); !line.isEmpty();
+       line = status.readLine())
+    if (line.startsWith(field + ":")) {
+      const QByteArray value = line.mid(field.size() + 1).trimmed();
+      return value.split(' ').value(0).toLongLong();
+    }
+
+  return -1;
+}
+
+// peak of resident memory is kept for the whole life of the process, so it
+// is reset to the current size first; false where it cannot be
+static bool resetPeakMemory() {
+  QFile clear_refs("/proc/self/clear_refs");
+  return clear_refs.open(QIODevice::WriteOnly) && clear_refs.write("5") == 1;
+}
+
+// large images are first shown from a quick downsampled decode, replaced by
+// the full one once it is done; formats which cannot scale while decoding
+// (only JPEG can, of the common ones) go straight to the full decode
+void RenderThread::decodeFile(QString file_name, QRect clip, Drawer& drawer) {
+  const bool peak_reset = resetPeakMemory();
+  const qint64 resident = memoryStatus("VmRSS");
+  QElapsedTimer decode_timer;
+  decode_timer.start();
+
+  // size is read from the header only, without decoding
+  QImageReader reader(file_name);
+  QRect region = clip;
+  if (reader.size().isValid()) {
+    const QRect bounds(QPoint(), reader.size());
+    region = clip.isEmpty() ? bounds : clip & bounds;
+    if (region.isEmpty()) {
+      qWarning() << "Clip rectangle" << clip << "is outside of the image";
+      return;
+    }
+  }
+
+  // preview travels to the GUI thread at its decoded size and is stretched
+  // there, so the canvas of the full size is allocated only once
+  const QSize preview_size = region.size().scaled(
+      PREVIEW_SIZE, PREVIEW_SIZE, Qt::KeepAspectRatio);
+  if (reader.supportsOption(QImageIOHandler::ScaledSize) &&
+      preview_size.width() < region.width()) {
+    QImageReader preview_reader(file_name);
+    if (!clip.isEmpty()) preview_reader.setClipRect(region);
+    preview_reader.setScaledSize(preview_size);
+    const QImage preview = preview_reader.read();
+    if (!preview.isNull()) {
+      publishPreview(preview, region.size());
+      qDebug() << "Preview decoded in" << decode_timer.elapsed() << "ms";
+    }
+  }
+
+  // decoders (like the PNG one) write into a given image of their size and
+  // format, so the aligned canvas is filled without a copy
+  QImage loaded;
+  if (!tiled && reader.imageFormat() == QImage::Format_ARGB32)
+    loaded = Drawer::createAlignedImage(region.width(), region.height());
+
+  // formats which cannot decode a part are clipped by the reader afterwards
+  if (!clip.isEmpty()) reader.setClipRect(region);
+  if (!reader.read(&loaded)) {
+    qWarning() << "Image has not been loaded successfully:"
+               << reader.errorString();
+    replaced = canvasRect();  // current canvas takes the place of preview
+    return;
+  }
+  const qint64 decode_time = decode_timer.elapsed();
+  const QSize loaded_size = loaded.size();
+  replaceImage(std::move(loaded), drawer);
+
+  // without a reset only the growth of resident memory is known
+  if (peak_reset)
+    qDebug().nospace() << "Decoded " << loaded_size.width() << "x"
+                       << loaded_size.height() << " in " << decode_time
+                       << " ms, peak memory " << memoryStatus("VmHWM")
+                       << " kB";
+  else
+    qDebug().nospace() << "Decoded " << loaded_size.width() << "x"
+                       << loaded_size.height() << " in " << decode_time
+                       << " ms, resident memory grew by "
+                       << memoryStatus("VmRSS") - resident << " kB";
+}
+
+// tiled canvas cannot work on mapped rows, nor can a part of the file, so
+// rows of `clip` (all of them if it is empty) are copied straight into an
+// aligned image
+QImage RenderThread::readRawFile(QString file_name, QRect clip) {
+  RawImage mapped;
+  if (!mapped.open(file_name, false)) return QImage();
+
+  const QImage source = mapped.image();
+  const QRect area = clip.isEmpty() ? source.rect() : clip & source.rect();
+  QImage result = Drawer::createAlignedImage(area.width(), area.height());
+  if (result.isNull()) return result;
+
+  for (int y = 0; y < area.height(); ++y)
+    memcpy(result.scanLine(y),
+           source.constScanLine(area.top() + y) + area.left() * sizeof(QRgb),
+           area.width() * sizeof(QRgb));
+
+  return result;
+}
+
+// converts pixels between the contiguous image and the tiled store
+void RenderThread::setTiled(bool _tiled) {
+  submit([this, _tiled](Drawer& drawer) {
+    if (tiled == _tiled) return;
+
+    // canvas stays tiled when its pixels do not fit into a single image
+    QImage dense;
+    if (!_tiled) {
+      dense = Drawer::toWorkingFormat(tiles.toImage());
+      if (dense.isNull()) {
+        qWarning() << "Canvas is too big to be untiled, it stays tiled";
+        replaced = canvasRect();  // canvas learns it is still tiled
+        return;
+      }
+    }
+
+    tiled = _tiled;
+    history.clear();
+
+    if (tiled) {
+      tiles = TiledImage(image);
+      image = QImage();
+      raw.reset();
+      drawer.setTiledImage(&tiles);
+      qDebug() << "Tiled canvas memory usage:" << tiles.memoryUsage() << "B";
+    } else {
+      image.swap(dense);
+      tiles = TiledImage();
+      drawer.setImage(&image);
+    }
+
+    drawer.resetDirtyRegion();
+    replaced = canvasRect();
+  });
+}
+
+// keeps the top left part of the picture
+void RenderThread::setCanvasSize(int _width, int _height, QColor background) {
+  submit([this, _width, _height, background](Drawer& drawer) {
+    history.clear();
+    if (tiled) {
+      tiles.resize(_width, _height, background.rgba());
+      drawer.setTiledImage(&tiles);
+    } else {
+      QImage resized = Drawer::createAlignedImage(_width, _height);
+      if (resized.isNull()) return;  // too big, canvas stays as it was
+
+      resized.fill(background);
+      QPainter painter(&resized);
+      painter.setCompositionMode(QPainter::CompositionMode_Source);
+      painter.drawImage(0, 0, image);
+      painter.end();
+
+      image.swap(resized);
+      resized = QImage();
+      raw.reset();
+      drawer.setImage(&image);
+    }
+
+    drawer.resetDirtyRegion();
+    replaced = canvasRect();
+  });
+}
+
+void RenderThread::clear(QColor color) {
+  submit([this, color](Drawer&) {
+    // uniform tiles drop their pixels, so clearing also frees memory
+    history.touch(canvasRect());
+    if (tiled)
+      tiles.fill(color.rgba());
+    else
+      image.fill(color);
+    replaced = canvasRect();
+  });
+}
+
+// saves pixels after all commands submitted before; they are only taken
+// here and encoded on a worker thread, so drawing goes on meanwhile
+void RenderThread::saveFile(QString file_name, int quality) {
+  submit(
+      [this, file_name, quality](Drawer&) {
+        // mapped file already holds the pixels, only changed pages are written
+        if (raw && raw->fileName() == QFileInfo(file_name).absoluteFilePath()) {
+          emit saveStarted(file_name);
+          const bool successful = raw->sync();
+          if (!successful)
+            qWarning() << "Image has not been saved successfully";
+          emit saveFinished(file_name, successful);
+          return;
+        }
+
+        // tiles share pixels until written; plain image is written by drawer
+        // through a raw pointer, so it is copied, which is still much faster
+        // than encoding
+        const TiledImage tiles_snapshot = tiled ? tiles : TiledImage();
+        const QImage image_snapshot = tiled ? QImage() : image.copy();
+
+        // finished saves are dropped, so only running ones are kept
+        const QList<QFuture<void>> futures = saves.futures();
+        saves.clearFutures();
+        for (const QFuture<void>& future : futures)
+          if (!future.isFinished()) saves.addFuture(future);
+
+        emit saveStarted(file_name);
+        saves.addFuture(QtConcurrent::run([=]() {
+          const QImage saved = image_snapshot.isNull()
+                                   ? tiles_snapshot.toImage()
+                                   : image_snapshot;
+          bool successful;
+          if (saved.isNull()) {
+            successful = false;
+            qWarning() << "Image has not been saved successfully: too big "
+                          "for a single image";
+          } else if (RawImage::isRawFile(file_name)) {
+            successful = RawImage::write(file_name, saved);
+            if (!successful)
+              qWarning() << "Image has not been saved successfully";
+          } else {
+            QImageWriter writer(file_name);  // format guessed from extension
+            writer.setQuality(quality);
+            successful = writer.write(saved);
+            if (!successful)
+              qWarning() << "Image has not been saved successfully:"
+                         << writer.errorString();
+          }
+          emit saveFinished(file_name, successful);
+        }));
+      },
+      tr("Taking picture to save"));
+}
+
+
+/*  ------------------------------------------------------------------------  */
+/*  HISTORY  */
+
+void RenderThread::undo() {
+  submit([this](Drawer&) { replaced += history.undo(); }, tr("Undoing"));
+}
+
+void RenderThread::redo() {
+  submit([this](Drawer&) { replaced += history.redo(); }, tr("Redoing"));
+}
+
+void RenderThread::setUndoHistory(int _megabytes, bool _compress) {
+  submit([this, _megabytes, _compress](Drawer&) {
+    history.setBudget(qint64(_megabytes) * 1024 * 1024);
+    history.setCompression(_compress);
+  });
+}
@@ -0,0 +1,111 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QtConcurrent>
+#include <QtWidgets>
+#include <atomic>
+#include <functional>
+#include "drawer.h"
+#include "mippyramid.h"
+#include "rawimage.h"
+#include "steptrace.h"
+#include "tiledimage.h"
+#include "undohistory.h"
+
+// pixels changed by the render thread since the GUI thread took last frame
+struct RenderFrame {
+  QSize size;  // of the whole canvas
+  bool tiled = false;
+  QVector<QRect> rects;     // changed parts of the canvas, in order
+  QVector<QImage> patches;  // their pixels, plain canvas only
+  TiledImage tiles;  // whole tiled canvas; copies share pixels of tiles
+  QVector<StepTrace> traces;  // of operations run in debug mode
+  QImage preview;  // of a picture being loaded, to be stretched over size
+};
+
+// Owns pixels of the canvas and runs drawing commands on them one by one, so
+// long operations never block the GUI thread. Finished (and, during long
+// commands, partial) results are handed over as frames; frameReady() is
+// emitted whenever there is one to take.
+class RenderThread : public QThread {
+  Q_OBJECT
+ public:
+  typedef std::function<void(Drawer&)> Command;
+  static const int PREVIEW_SIZE = 1024;  // longer side of previews of loading
+
+  explicit RenderThread(QObject* parent = 0);
+  virtual ~RenderThread();
+
+  // changes of a `continues` command are undone together with the previous
+  void submit(Command command, QString name = QString(),
+              bool continues = false);
+  void cancel();  // stops the running command, queued ones still run
+  RenderFrame takeFrame();
+
+  /*  COMMANDS REPLACING THE WHOLE CANVAS  */
+  // `clip` limits loading to a part of the image, empty loads all of it
+  void loadFile(QString file_name, QRect clip = QRect());
+  // the file is removed once the picture is recovered
+  void recoverFile(QString file_name);
+  void setTiled(bool _tiled);
+  void setCanvasSize(int _width, int _height, QColor background);
+  void clear(QColor color);
+  // `quality` is passed to QImageWriter, -1 is the default of the format
+  void saveFile(QString file_name, int quality);
+
+  /*  HISTORY  */
+  void undo();
+  void redo();
+  void setUndoHistory(int _megabytes, bool _compress);
+
+ signals:
+  void frameReady();
+  void commandStarted(QString name);
+  void progressChanged(int percent);
+  void commandFinished(QString name, bool cancelled);
+  void saveStarted(QString file_name);
+  void saveFinished(QString file_name, bool successful);
+
+ protected:
+  virtual void run() override;
+
+ private:
+  // touched only by the render thread once it runs
+  QScopedPointer<RawImage> raw;  // file mapped under image; outlives image
+  QImage image;
+  TiledImage tiles;
+  bool tiled = false;
+  MipPyramid mipmaps;
+  Drawer drawer;
+  UndoHistory history;
+  QRegion replaced;  // changed outside of drawer
+  QElapsedTimer timer;
+  qint64 last_publish = 0;
+
+  QMutex queue_mutex;
+  QWaitCondition queue_changed;
+  struct Queued {
+    QString name;
+    Command command;
+    bool continues;
+  };
+  QQueue<Queued> queue;
+  bool quitting = false;
+  std::atomic<bool> cancelled{false};
+
+  QFutureSynchronizer<void> saves;  // encoding on worker threads
+
+  QMutex frame_mutex;
+  RenderFrame frame;
+
+  void replaceImage(QImage loaded, Drawer& drawer);
+  void decodeFile(QString file_name, QRect clip, Drawer& drawer);
+  void mapFile(QString file_name, Drawer& drawer);
+  static QImage readRawFile(QString file_name, QRect clip);
+  bool progress(int done, int total);
+  void publish();
+  void publishPreview(const QImage& preview, QSize size);
+  QRect canvasRect() const;
+};
+
+#endif  // RENDERTHREAD_H
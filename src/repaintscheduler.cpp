@@ -0,0 +1,95 @@
+#include "repaintscheduler.h"
+
+RepaintScheduler::RepaintScheduler(QWidget* _target, int _rate)
+    : QObject(_target), target(_target) {
+  timer.setSingleShot(true);
+  timer.setTimerType(Qt::PreciseTimer);
+  connect(&timer, &QTimer::timeout, this, &RepaintScheduler::flush);
+  setRate(_rate);
+  clock.start();
+}
+
+void RepaintScheduler::request() { schedule(); }
+
+void RepaintScheduler::request(const QRect& rect) {
+  if (rect.isEmpty()) return;
+  pending += rect;
+  schedule();
+}
+
+void RepaintScheduler::requestAll() {
+  pending_all = true;
+  schedule();
+}
+
+void RepaintScheduler::setRate(int _rate) {
+  frame_rate = qBound(1, _rate, 1000);
+  timer.setInterval(interval());
+}
+
+int RepaintScheduler::rate() const { return frame_rate; }
+int RepaintScheduler::interval() const { return 1000 / frame_rate; }
+
+qint64 RepaintScheduler::frames() const { return frame_count; }
+qint64 RepaintScheduler::merged() const { return merged_count; }
+qint64 RepaintScheduler::dropped() const { return dropped_count; }
+qint64 RepaintScheduler::maxLatency() const { return latency_max; }
+
+qreal RepaintScheduler::averageLatency() const {
+  return frame_count > 0 ? qreal(latency_total) / frame_count : 0;
+}
+
+void RepaintScheduler::resetCounters() {
+  frame_count = 0;
+  merged_count = 0;
+  dropped_count = 0;
+  latency_max = 0;
+  latency_total = 0;
+}
+
+QString RepaintScheduler::statistics() const {
+  return tr("%1 fps target, %2 frames, %3 merged requests, %4 dropped frames, "
+            "latency %5 ms average, %6 ms max")
+      .arg(frame_rate)
+      .arg(frame_count)
+      .arg(merged_count)
+      .arg(dropped_count)
+      .arg(averageLatency(), 0, 'f', 1)
+      .arg(latency_max);
+}
+
+// requests made while flushing belong to the frame being flushed
+void RepaintScheduler::schedule() {
+  if (flushing_now) return;
+  if (timer.isActive()) {
+    ++merged_count;
+    return;
+  }
+
+  // a frame right after a long pause is not delayed
+  const qint64 now = clock.elapsed();
+  first_request = now;
+  due = qMax(now, due + interval());
+  timer.start(int(due - now));
+}
+
+void RepaintScheduler::flush() {
+  const qint64 now = clock.elapsed();
+  if (now - due >= interval()) dropped_count += (now - due) / interval();
+  due = now;
+
+  flushing_now = true;
+  emit flushing();
+  flushing_now = false;
+
+  if (pending_all)
+    target->update();
+  else
+    target->update(pending);
+  pending = QRegion();
+  pending_all = false;
+
+  ++frame_count;
+  latency_total += now - first_request;
+  latency_max = qMax(latency_max, now - first_request);
+}
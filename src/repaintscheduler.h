@@ -0,0 +1,54 @@
+#ifndef REPAINTSCHEDULER_H
+#define REPAINTSCHEDULER_H
+
+#include <QtWidgets>
+
+// Gathers parts of a widget to be repainted and repaints them together at
+// most once per display frame. Before each repaint `flushing` is emitted, so
+// owners can bring their pixels up to date and add more parts.
+class RepaintScheduler : public QObject {
+  Q_OBJECT
+
+ public:
+  explicit RepaintScheduler(QWidget* _target, int _rate = 60);
+
+  void request();  // flush on next frame without repainting anything itself
+  void request(const QRect& rect);
+  void requestAll();
+  void setRate(int _rate);  // in frames per second
+  int rate() const;
+  int interval() const;  // in ms
+
+  qint64 frames() const;   // repaints done
+  qint64 merged() const;   // requests joined with an already pending frame
+  qint64 dropped() const;  // display frames missed because a flush was late
+  qint64 maxLatency() const;  // longest wait of a request for its flush, ms
+  qreal averageLatency() const;
+  void resetCounters();
+  QString statistics() const;
+
+ signals:
+  void flushing();
+
+ private:
+  QWidget* target;
+  QRegion pending;
+  bool pending_all = false;
+  bool flushing_now = false;
+  int frame_rate;
+  QTimer timer;
+  QElapsedTimer clock;
+  qint64 due = 0;  // when the pending frame should be flushed
+  qint64 first_request = 0;
+
+  qint64 frame_count = 0;
+  qint64 merged_count = 0;
+  qint64 dropped_count = 0;
+  qint64 latency_max = 0;
+  qint64 latency_total = 0;
+
+  void schedule();
+  void flush();
+};
+
+#endif  // REPAINTSCHEDULER_H
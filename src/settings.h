@@ -4,7 +4,17 @@
 #include <QtWidgets>
 
 // operations applied with additional info from user (mouse clicks)
-enum class Mode { none, click, line, circle, bezier, spline, polygon, fill };
+enum class Mode {
+  none,
+  click,
+  stroke,
+  line,
+  circle,
+  bezier,
+  spline,
+  polygon,
+  fill
+};
 
 // operations that can be applied immediately
 enum class Operation { vgradient, hgradient, shift, rotate, scale, shear };
@@ -13,6 +23,7 @@ enum class LineType { bresenham, antialiased };
 enum class CircleType { bresenham, approximated };
 enum class FillType { scanline, stack, recursive };
 enum class InterpolationType { nearest, bilinear };
+enum class RotationType { matrix, shears };
 
 struct Settings {
   int width;
@@ -21,6 +32,7 @@ struct Settings {
   Mode mode;
   bool debug;
   bool grid;
+  bool tiled;
   qreal zoom;
   LineType line_type;
   CircleType circle_type;
@@ -34,11 +46,21 @@ struct Settings {
   int circle_steps;
   QColor debug_color;
   InterpolationType interpolation_type;
+  int transform_tile_size;
+  bool transform_prefetch;
+  int transform_cache_size;  // in megabytes
+  int progress_threshold;    // in milliseconds
+  int frame_rate;            // repaints per second at most
+  int undo_budget;           // in megabytes
+  bool undo_compression;
+  int autosave_interval;     // in seconds, 0 disables autosave
+  int save_quality;          // 0 - 100, -1 is the default of a format
 
   int shift_x;
   int shift_y;
   qreal rotate_angle;
   bool rotate_inplace;
+  RotationType rotation_type;
   qreal scale_x;
   qreal scale_y;
   bool scale_inplace;
@@ -54,6 +76,7 @@ struct Settings {
     mode = Mode::click;
     debug = false;
     grid = false;
+    tiled = false;
     zoom = 1.0;
     line_type = LineType::bresenham;
     circle_type = CircleType::bresenham;
@@ -66,11 +89,22 @@ struct Settings {
     main_color = QColor(192, 255, 63);
     circle_steps = 15;
     debug_color = QColor(0, 255, 0);
+    interpolation_type = InterpolationType::nearest;
+    transform_tile_size = 64;
+    transform_prefetch = true;
+    transform_cache_size = 64;
+    progress_threshold = 500;
+    frame_rate = 60;
+    undo_budget = 256;
+    undo_compression = false;
+    autosave_interval = 10;
+    save_quality = -1;
 
     shift_x = 20;
     shift_y = 35;
     rotate_angle = 30;
     rotate_inplace = true;
+    rotation_type = RotationType::matrix;
     scale_x = 1.05;
     scale_y = 0.75;
     scale_inplace = true;
@@ -86,6 +120,7 @@ struct Settings {
     dbg.nospace() << "\nmode: " << int(sett.mode);
     dbg.nospace() << "\ndebug: " << sett.debug;
     dbg.nospace() << "\ngrid: " << sett.grid;
+    dbg.nospace() << "\ntiled: " << sett.tiled;
     dbg.nospace() << "\nscale: " << sett.zoom;
     dbg.nospace() << "\nline_type: " << int(sett.line_type);
     dbg.nospace() << "\ncircle_type: " << int(sett.circle_type);
@@ -101,6 +136,7 @@ struct Settings {
     dbg.nospace() << "\nshift_y: " << sett.shift_y;
     dbg.nospace() << "\nrotation angle: " << sett.rotate_angle;
     dbg.nospace() << "\nrotate_inplace: " << sett.rotate_inplace;
+    dbg.nospace() << "\nrotation_type: " << int(sett.rotation_type);
     dbg.nospace() << "\nscale_x: " << sett.scale_x;
     dbg.nospace() << "\nscale_y: " << sett.scale_y;
     dbg.nospace() << "\nscale_inplace: " << sett.scale_inplace;
@@ -108,6 +144,15 @@ struct Settings {
     dbg.nospace() << "\nshear_y: " << sett.shear_y;
     dbg.nospace() << "\nshear_inplace: " << sett.shear_inplace;
     dbg.nospace() << "\ninterpolation_type: " << int(sett.interpolation_type);
+    dbg.nospace() << "\ntransform_tile_size: " << sett.transform_tile_size;
+    dbg.nospace() << "\ntransform_prefetch: " << sett.transform_prefetch;
+    dbg.nospace() << "\ntransform_cache_size: " << sett.transform_cache_size;
+    dbg.nospace() << "\nprogress_threshold: " << sett.progress_threshold;
+    dbg.nospace() << "\nframe_rate: " << sett.frame_rate;
+    dbg.nospace() << "\nundo_budget: " << sett.undo_budget;
+    dbg.nospace() << "\nundo_compression: " << sett.undo_compression;
+    dbg.nospace() << "\nautosave_interval: " << sett.autosave_interval;
+    dbg.nospace() << "\nsave_quality: " << sett.save_quality;
 
     return dbg;
   }
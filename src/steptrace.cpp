@@ -0,0 +1,75 @@
+#include "steptrace.h"
+
+// signed numbers are zigzag encoded, so small deltas of both signs are short
+static inline quint32 zigzag(int value) {
+  return (quint32(value) << 1) ^ quint32(value >> 31);
+}
+
+static inline int unzigzag(quint32 value) {
+  return int(value >> 1) ^ -int(value & 1);
+}
+
+StepTrace::StepTrace() {}
+StepTrace::StepTrace(const QImage& _before) : before_image(_before) {}
+
+void StepTrace::beginStep() {
+  offsets.push_back(data.size());
+  last_y = 0;
+  last_x = 0;
+}
+
+// span of row `y` from `x_from` to `x_to` inclusive, relative to previous one
+void StepTrace::addSpan(int y, int x_from, int x_to) {
+  if (offsets.isEmpty()) beginStep();
+
+  writeNumber(zigzag(y - last_y));
+  writeNumber(zigzag(x_from - last_x));
+  writeNumber(x_to - x_from);
+  last_y = y;
+  last_x = x_from;
+}
+
+void StepTrace::finish(const QImage& _after) { after_image = _after; }
+
+int StepTrace::stepCount() const { return offsets.size(); }
+
+QVector<QRect> StepTrace::step(int n) const {
+  QVector<QRect> spans;
+  const uchar* position = (const uchar*)data.constData() + offsets[n];
+  const uchar* end = (const uchar*)data.constData() +
+                     (n + 1 < offsets.size() ? offsets[n + 1] : data.size());
+
+  int y = 0;
+  int x = 0;
+  while (position < end) {
+    y += unzigzag(readNumber(position));
+    x += unzigzag(readNumber(position));
+    const int length = readNumber(position) + 1;
+    spans.push_back(QRect(x, y, length, 1));
+  }
+
+  return spans;
+}
+
+const QImage& StepTrace::before() const { return before_image; }
+const QImage& StepTrace::after() const { return after_image; }
+
+// 7 bits per byte, highest bit set when more bytes follow
+void StepTrace::writeNumber(quint32 value) {
+  while (value >= 0x80) {
+    data.append(char((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  data.append(char(value));
+}
+
+quint32 StepTrace::readNumber(const uchar*& position) {
+  quint32 value = 0;
+  for (int shift = 0;; shift += 7) {
+    const uchar byte = *position++;
+    value |= quint32(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) break;
+  }
+
+  return value;
+}
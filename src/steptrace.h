@@ -0,0 +1,36 @@
+#ifndef STEPTRACE_H
+#define STEPTRACE_H
+
+#include <QtWidgets>
+
+// Pixels changed by each step of an algorithm, as horizontal spans, together
+// with the image before and after it. Spans are delta encoded into variable
+// length integers, so a step takes only a few bytes and recording does not
+// slow the algorithm down.
+class StepTrace {
+ public:
+  StepTrace();
+  StepTrace(const QImage& _before);
+
+  void beginStep();
+  void addSpan(int y, int x_from, int x_to);
+  void finish(const QImage& _after);
+
+  int stepCount() const;
+  QVector<QRect> step(int n) const;  // spans as rectangles 1 pixel high
+  const QImage& before() const;
+  const QImage& after() const;
+
+ private:
+  QImage before_image;
+  QImage after_image;
+  QByteArray data;
+  QVector<int> offsets;  // start of each step in data
+  int last_y = 0;        // previous span of the current step
+  int last_x = 0;
+
+  void writeNumber(quint32 value);
+  static quint32 readNumber(const uchar*& position);
+};
+
+#endif  // STEPTRACE_H
@@ -0,0 +1,202 @@
+#include "tiledimage.h"
+
+TiledImage::TiledImage() {}
+
+TiledImage::TiledImage(int _width, int _height, QRgb color) {
+  m_width = _width;
+  m_height = _height;
+  columns = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+  rows = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+  tiles.resize(columns * rows);
+  fill(color);
+}
+
+// tiles that are uniform in `image` stay unallocated
+TiledImage::TiledImage(const QImage& image)
+    : TiledImage(image.width(), image.height()) {
+  const QImage source = image.convertToFormat(QImage::Format_ARGB32);
+
+  for (int row = 0; row < rows; ++row) {
+    for (int column = 0; column < columns; ++column) {
+      const QRect area = QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE,
+                               TILE_SIZE) &
+                         rect();
+      const QRgb first = source.pixel(area.topLeft());
+
+      bool uniform = true;
+      for (int y = area.top(); y <= area.bottom() && uniform; ++y) {
+        const QRgb* line = (const QRgb*)source.constScanLine(y);
+        for (int x = area.left(); x <= area.right(); ++x) {
+          if (line[x] != first) {
+            uniform = false;
+            break;
+          }
+        }
+      }
+
+      Tile& tile = tiles[row * columns + column];
+      tile.color = first;
+      if (uniform) continue;
+
+      detach(tile);
+      for (int y = area.top(); y <= area.bottom(); ++y) {
+        const QRgb* line = (const QRgb*)source.constScanLine(y);
+        QRgb* tile_line =
+            tile.pixels.data() + (y - area.top()) * TILE_SIZE;
+        std::copy(line + area.left(), line + area.right() + 1, tile_line);
+      }
+    }
+  }
+}
+
+int TiledImage::width() const { return m_width; }
+int TiledImage::height() const { return m_height; }
+QRect TiledImage::rect() const { return QRect(0, 0, m_width, m_height); }
+bool TiledImage::isNull() const { return tiles.isEmpty(); }
+
+TiledImage::Tile& TiledImage::tileAt(int x, int y) {
+  return tiles[(y / TILE_SIZE) * columns + x / TILE_SIZE];
+}
+
+const TiledImage::Tile& TiledImage::tileAt(int x, int y) const {
+  return tiles[(y / TILE_SIZE) * columns + x / TILE_SIZE];
+}
+
+// gives uniform tile its own pixels
+void TiledImage::detach(Tile& tile) {
+  if (tile.pixels.isEmpty())
+    tile.pixels.fill(tile.color, TILE_SIZE * TILE_SIZE);
+}
+
+// coordinates are expected to be inside of the image
+QRgb TiledImage::pixel(int x, int y) const {
+  const Tile& tile = tileAt(x, y);
+  if (tile.pixels.isEmpty()) return tile.color;
+
+  return tile.pixels[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+void TiledImage::setPixel(int x, int y, QRgb color) {
+  Tile& tile = tileAt(x, y);
+  if (tile.pixels.isEmpty()) {
+    if (tile.color == color) return;
+    detach(tile);
+  }
+
+  tile.pixels[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] = color;
+}
+
+void TiledImage::fill(QRgb color) {
+  for (Tile& tile : tiles) {
+    tile.color = color;
+    tile.pixels = QVector<QRgb>();
+  }
+}
+
+// tiles covered completely become uniform and release their pixels
+void TiledImage::fillRect(QRect area, QRgb color) {
+  area &= rect();
+  if (area.isEmpty()) return;
+
+  for (int row = area.top() / TILE_SIZE; row <= area.bottom() / TILE_SIZE;
+       ++row) {
+    for (int column = area.left() / TILE_SIZE;
+         column <= area.right() / TILE_SIZE; ++column) {
+      const QRect tile_rect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE,
+                            TILE_SIZE);
+      const QRect part = area & tile_rect;
+      Tile& tile = tiles[row * columns + column];
+
+      if (part == (tile_rect & rect())) {
+        tile.color = color;
+        tile.pixels = QVector<QRgb>();
+        continue;
+      }
+      if (tile.pixels.isEmpty() && tile.color == color) continue;
+
+      detach(tile);
+      for (int y = part.top(); y <= part.bottom(); ++y) {
+        QRgb* line =
+            tile.pixels.data() + (y - tile_rect.top()) * TILE_SIZE;
+        std::fill(line + part.left() - tile_rect.left(),
+                  line + part.right() - tile_rect.left() + 1, color);
+      }
+    }
+  }
+}
+
+// parts of `image` outside of the tiled image are left out
+void TiledImage::paste(QPoint position, const QImage& image) {
+  const QRect area = QRect(position, image.size()) & rect();
+  if (area.isEmpty()) return;
+
+  for (int row = area.top() / TILE_SIZE; row <= area.bottom() / TILE_SIZE;
+       ++row) {
+    for (int column = area.left() / TILE_SIZE;
+         column <= area.right() / TILE_SIZE; ++column) {
+      const QRect tile_rect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE,
+                            TILE_SIZE);
+      const QRect part = area & tile_rect;
+      Tile& tile = tiles[row * columns + column];
+
+      detach(tile);
+      for (int y = part.top(); y <= part.bottom(); ++y) {
+        const QRgb* line = (const QRgb*)image.constScanLine(y - position.y());
+        std::copy(line + part.left() - position.x(),
+                  line + part.right() - position.x() + 1,
+                  tile.pixels.data() + (y - tile_rect.top()) * TILE_SIZE +
+                      part.left() - tile_rect.left());
+      }
+    }
+  }
+}
+
+// keeps tiles of the overlapping part, the new area gets `color`
+void TiledImage::resize(int _width, int _height, QRgb color) {
+  TiledImage result(_width, _height, color);
+  for (int row = 0; row < qMin(rows, result.rows); ++row)
+    for (int column = 0; column < qMin(columns, result.columns); ++column)
+      result.tiles[row * result.columns + column] =
+          tiles[row * columns + column];
+
+  // edge tiles may hold pixels from outside of the previous image
+  result.fillRect(QRect(m_width, 0, _width - m_width, _height), color);
+  result.fillRect(QRect(0, m_height, _width, _height - m_height), color);
+
+  *this = result;
+}
+
+QImage TiledImage::toImage() const { return render(rect(), 1.0); }
+
+// nearest neighbour rendering of `target`, a rectangle in coordinates of the
+// image scaled by `zoom`; its cost depends on target size only. Null when
+// the result cannot be allocated (QImage holds at most 2 GB)
+QImage TiledImage::render(QRect target, qreal zoom) const {
+  QImage result(target.size(), QImage::Format_ARGB32);
+  if (result.isNull()) {
+    if (!target.isEmpty())
+      qWarning() << "Cannot allocate image" << target.width() << "x"
+                 << target.height();
+    return result;
+  }
+
+  for (int y = 0; y < target.height(); ++y) {
+    QRgb* line = (QRgb*)result.scanLine(y);
+    const int source_y = qMin(int((target.top() + y) / zoom), m_height - 1);
+    for (int x = 0; x < target.width(); ++x) {
+      const int source_x = qMin(int((target.left() + x) / zoom), m_width - 1);
+      line[x] = pixel(source_x, source_y);
+    }
+  }
+
+  return result;
+}
+
+qint64 TiledImage::tableBytes() const { return tiles.size() * sizeof(Tile); }
+
+qint64 TiledImage::memoryUsage() const {
+  qint64 bytes = tableBytes();
+  for (const Tile& tile : tiles) bytes += tile.pixels.size() * sizeof(QRgb);
+
+  return bytes;
+}
@@ -0,0 +1,52 @@
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <QtWidgets>
+
+// ARGB32 pixels split into square tiles. A tile keeps a single colour until
+// it is written to and only then allocates its pixels, so memory used by a
+// big, mostly empty canvas is proportional to the painted content.
+class TiledImage {
+ public:
+  static const int TILE_SIZE = 256;
+
+  TiledImage();
+  TiledImage(int _width, int _height, QRgb color = 0);
+  TiledImage(const QImage& image);
+
+  int width() const;
+  int height() const;
+  QRect rect() const;
+  bool isNull() const;
+
+  QRgb pixel(int x, int y) const;
+  void setPixel(int x, int y, QRgb color);
+  void fill(QRgb color);
+  void fillRect(QRect rect, QRgb color);
+  void paste(QPoint position, const QImage& image);  // ARGB32 `image`
+  void resize(int _width, int _height, QRgb color);
+
+  // null when too big for a single QImage
+  QImage toImage() const;
+  QImage render(QRect target, qreal zoom) const;
+  qint64 memoryUsage() const;
+  qint64 tableBytes() const;  // of the list of tiles alone
+
+ private:
+  struct Tile {
+    QRgb color = 0;        // colour of the whole tile, if pixels are empty
+    QVector<QRgb> pixels;  // TILE_SIZE * TILE_SIZE, allocated on write
+  };
+
+  int m_width = 0;
+  int m_height = 0;
+  int columns = 0;
+  int rows = 0;
+  QVector<Tile> tiles;
+
+  Tile& tileAt(int x, int y);
+  const Tile& tileAt(int x, int y) const;
+  void detach(Tile& tile);
+};
+
+#endif  // TILEDIMAGE_H
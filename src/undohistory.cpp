@@ -0,0 +1,229 @@
+#include "undohistory.h"
+#include <cstring>
+
+void UndoHistory::setBudget(qint64 _bytes) {
+  budget = _bytes;
+  evict();
+}
+
+void UndoHistory::setCompression(bool _compress) { compress = _compress; }
+
+void UndoHistory::clear() {
+  undo_steps.clear();
+  redo_steps.clear();
+  used = 0;
+  current = Step();
+  recording = false;
+}
+
+void UndoHistory::beginStep(QImage* _image, bool merge) {
+  image = _image;
+  tiles = nullptr;
+  columns = (image->width() + TILE_SIZE - 1) / TILE_SIZE;
+  const int rows = (image->height() + TILE_SIZE - 1) / TILE_SIZE;
+  if (saved.size() != columns * rows) saved.resize(columns * rows);
+  saved.fill(false);
+  beginStep(merge);
+}
+
+// copying a tiled canvas only shares its tiles
+void UndoHistory::beginStep(TiledImage* _tiles, bool merge) {
+  image = nullptr;
+  tiles = _tiles;
+  touched = QRect();
+  beginStep(merge);
+  current.tiled = true;
+  current.snapshot = *tiles;
+}
+
+void UndoHistory::beginStep(bool merge) {
+  current = Step();
+  merging = merge;
+  recording = budget > 0;
+}
+
+void UndoHistory::touch(QRect rect) {
+  if (!recording) return;
+  if (tiles != nullptr) {
+    touched |= rect;
+    return;
+  }
+
+  rect &= image->rect();
+  if (rect.isEmpty()) return;
+  for (int row = rect.top() / TILE_SIZE; row <= rect.bottom() / TILE_SIZE;
+       ++row)
+    for (int column = rect.left() / TILE_SIZE;
+         column <= rect.right() / TILE_SIZE; ++column) {
+      const int index = row * columns + column;
+      if (!saved.testBit(index)) saveTile(index);
+    }
+}
+
+// steps which changed nothing are dropped; a new change drops redo steps
+void UndoHistory::endStep() {
+  if (!recording) return;
+  recording = false;
+
+  if (current.tiled) {
+    if (touched.isEmpty()) return;
+    current.rect = touched & tiles->rect();
+    const QRect aligned(
+        QPoint(touched.left() / TiledImage::TILE_SIZE,
+               touched.top() / TiledImage::TILE_SIZE),
+        QPoint(touched.right() / TiledImage::TILE_SIZE,
+               touched.bottom() / TiledImage::TILE_SIZE));
+    // the first write after the snapshot copies the whole list of tiles, the
+    // snapshot keeps the previous one
+    current.bytes = qint64(aligned.width()) * aligned.height() *
+                        TiledImage::TILE_SIZE * TiledImage::TILE_SIZE *
+                        sizeof(QRgb) +
+                    current.snapshot.tableBytes();
+  } else if (current.tiles.isEmpty()) {
+    return;
+  }
+
+  redo_steps.clear();
+  used = 0;
+  for (const Step& step : undo_steps) used += step.bytes;
+
+  // earlier content of a tile is the one to go back to
+  if (merging && !undo_steps.isEmpty() &&
+      undo_steps.last().tiled == current.tiled) {
+    Step& previous = undo_steps.last();
+    if (!current.tiled)
+      for (auto it = current.tiles.constBegin(); it != current.tiles.constEnd();
+           ++it)
+        if (!previous.tiles.contains(it.key())) {
+          previous.tiles.insert(it.key(), it.value());
+          previous.bytes += tileBytes(it.value());
+          used += tileBytes(it.value());
+        }
+    previous.rect |= current.rect;
+  } else {
+    undo_steps.push_back(current);
+    used += current.bytes;
+  }
+  current = Step();
+
+  evict();
+}
+
+bool UndoHistory::canUndo() const { return !undo_steps.isEmpty(); }
+bool UndoHistory::canRedo() const { return !redo_steps.isEmpty(); }
+
+QRect UndoHistory::undo() {
+  if (undo_steps.isEmpty()) return QRect();
+
+  Step step = undo_steps.takeLast();
+  const QRect rect = swap(step);
+  redo_steps.push_back(step);
+
+  return rect;
+}
+
+QRect UndoHistory::redo() {
+  if (redo_steps.isEmpty()) return QRect();
+
+  Step step = redo_steps.takeLast();
+  const QRect rect = swap(step);
+  undo_steps.push_back(step);
+
+  return rect;
+}
+
+qint64 UndoHistory::memoryUsage() const { return used; }
+
+QRect UndoHistory::tileRect(int index) const {
+  return QRect((index % columns) * TILE_SIZE, (index / columns) * TILE_SIZE,
+               TILE_SIZE, TILE_SIZE) &
+         image->rect();
+}
+
+void UndoHistory::saveTile(int index) {
+  saved.setBit(index);
+  const QRect rect = tileRect(index);
+  const Tile tile = grab(rect);
+  current.tiles.insert(index, tile);
+  current.rect |= rect;
+  current.bytes += tileBytes(tile);
+}
+
+UndoHistory::Tile UndoHistory::grab(QRect rect) const {
+  Tile tile;
+  const QRgb first = ((const QRgb*)image->constScanLine(rect.top()))[rect.x()];
+  bool uniform = true;
+  for (int y = rect.top(); y <= rect.bottom() && uniform; ++y) {
+    const QRgb* line = (const QRgb*)image->constScanLine(y);
+    for (int x = rect.left(); x <= rect.right(); ++x)
+      if (line[x] != first) {
+        uniform = false;
+        break;
+      }
+  }
+
+  if (uniform) {
+    tile.color = first;
+  } else if (compress) {
+    QByteArray rows(rect.width() * rect.height() * sizeof(QRgb), 0);
+    for (int y = 0; y < rect.height(); ++y)
+      memcpy(rows.data() + y * rect.width() * sizeof(QRgb),
+             image->constScanLine(rect.top() + y) + rect.x() * sizeof(QRgb),
+             rect.width() * sizeof(QRgb));
+    tile.compressed = qCompress(rows, 1);  // fast, tiles are saved mid-draw
+  } else {
+    tile.pixels = image->copy(rect);
+  }
+
+  return tile;
+}
+
+void UndoHistory::put(const Tile& tile, QRect rect) {
+  QByteArray rows;
+  if (!tile.compressed.isEmpty()) rows = qUncompress(tile.compressed);
+
+  for (int y = 0; y < rect.height(); ++y) {
+    QRgb* line = (QRgb*)image->scanLine(rect.top() + y) + rect.x();
+    if (!tile.pixels.isNull())
+      memcpy(line, tile.pixels.constScanLine(y), rect.width() * sizeof(QRgb));
+    else if (!rows.isEmpty())
+      memcpy(line, rows.constData() + y * rect.width() * sizeof(QRgb),
+             rect.width() * sizeof(QRgb));
+    else
+      std::fill(line, line + rect.width(), tile.color);
+  }
+}
+
+qint64 UndoHistory::tileBytes(const Tile& tile) const {
+  return sizeof(Tile) + tile.compressed.size() +
+         (tile.pixels.isNull() ? 0 : tile.pixels.bytesPerLine() *
+                                         tile.pixels.height());
+}
+
+// exchanges pixels of the step with the current ones of the canvas
+QRect UndoHistory::swap(Step& step) {
+  used -= step.bytes;
+  if (step.tiled) {
+    std::swap(*tiles, step.snapshot);
+  } else {
+    step.bytes = 0;
+    for (auto it = step.tiles.begin(); it != step.tiles.end(); ++it) {
+      const QRect rect = tileRect(it.key());
+      const Tile now = grab(rect);
+      put(it.value(), rect);
+      it.value() = now;
+      step.bytes += tileBytes(now);
+    }
+  }
+  used += step.bytes;
+
+  return step.rect;
+}
+
+// oldest undo steps go first, then redo steps furthest from the current state
+void UndoHistory::evict() {
+  while (used > budget && !undo_steps.isEmpty())
+    used -= undo_steps.takeFirst().bytes;
+  while (used > budget && !redo_steps.isEmpty())
+    used -= redo_steps.takeFirst().bytes;
+}
@@ -0,0 +1,87 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QtWidgets>
+#include "tiledimage.h"
+
+// Undo and redo of changes to the canvas. A step keeps only the tiles its
+// operation was about to change, saved the first time it writes into each of
+// them; undo swaps them with the current pixels, so the same step then redoes.
+// Saved tiles are implicitly shared images, a single colour when uniform, and
+// optionally compressed. A tiled canvas shares pixels of its tiles anyway, so
+// its steps are copies of the whole TiledImage, costing only tiles changed
+// later. Oldest steps are dropped when the history goes over its budget.
+class UndoHistory {
+ public:
+  static const int TILE_SIZE = 64;
+
+  void setBudget(qint64 _bytes);
+  void setCompression(bool _compress);
+  void clear();  // needed whenever the canvas is replaced or resized
+
+  // `merge` adds changes of the step to the previous one, if it is on top
+  void beginStep(QImage* _image, bool merge);
+  void beginStep(TiledImage* _tiles, bool merge);
+  inline void touch(int x, int y);  // before pixel (x, y) is written
+  void touch(QRect rect);
+  void endStep();
+
+  bool canUndo() const;
+  bool canRedo() const;
+  QRect undo();  // returns the changed part of the canvas
+  QRect redo();
+  qint64 memoryUsage() const;
+
+ private:
+  struct Tile {
+    QImage pixels;          // null when uniform or compressed
+    QByteArray compressed;  // rows of pixels, without padding
+    QRgb color = 0;         // of a uniform tile
+  };
+
+  struct Step {
+    QHash<int, Tile> tiles;  // by index of a tile in the image
+    TiledImage snapshot;     // whole tiled canvas before (or after) the step
+    bool tiled = false;
+    QRect rect;  // changed part of the canvas
+    qint64 bytes = 0;
+  };
+
+  qint64 budget = 256 * 1024 * 1024;
+  bool compress = false;
+  QVector<Step> undo_steps;  // most recent last
+  QVector<Step> redo_steps;  // next to redo last
+  qint64 used = 0;
+
+  // step being recorded
+  QImage* image = nullptr;
+  TiledImage* tiles = nullptr;
+  bool recording = false;
+  bool merging = false;
+  Step current;
+  int columns = 0;
+  QBitArray saved;  // tiles of the image already in the current step
+  QRect touched;    // of a tiled canvas
+
+  void beginStep(bool merge);
+  QRect tileRect(int index) const;
+  void saveTile(int index);
+  Tile grab(QRect rect) const;
+  void put(const Tile& tile, QRect rect);
+  qint64 tileBytes(const Tile& tile) const;
+  QRect swap(Step& step);
+  void evict();
+};
+
+inline void UndoHistory::touch(int x, int y) {
+  if (!recording) return;
+  if (tiles != nullptr) {
+    touched |= QRect(x, y, 1, 1);
+    return;
+  }
+
+  const int index = (y / TILE_SIZE) * columns + x / TILE_SIZE;
+  if (!saved.testBit(index)) saveTile(index);
+}
+
+#endif  // UNDOHISTORY_H